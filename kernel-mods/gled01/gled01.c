@@ -3,6 +3,32 @@
  * @author Santiago Pagola 
  * @date   15/06/2017
  * @brief  A kernel module for controlling a GPIO LED/button pair.
+ *
+ * Reading /dev/gled01 returns the button presses since the previous read on
+ * the same file, as timestamped events with the time the button was held, and
+ * blocks (unless O_NONBLOCK) until there is one. poll()/select()/epoll report
+ * POLLIN when there are events to read, and files can also get SIGIO or an
+ * eventfd signalled instead. The current state is also in sysfs and in a
+ * read-only status page, see gled01.h.
+ *
+ * Both edges of the button interrupt. The hard interrupt handler only takes a
+ * timestamp and the button level and queues them in a kfifo, the IRQ thread
+ * toggles the LED when the button goes down and pairs it with the release into
+ * one event.
+ *
+ * Button edges are debounced for debounce_us, by the GPIO controller if it
+ * can, otherwise in software: the first edge starts an hrtimer, the bounces
+ * until it expires are ignored and the button only changes state if it settled
+ * at the other level by then.
+ *
+ * The LED is also registered with the LED class as gled01::user, so kernel LED
+ * triggers (timer, oneshot, heartbeat, netdev, ...) can drive it through
+ * /sys/class/leds/gled01::user. Blinking is timed by an hrtimer in the driver.
+ *
+ * /sys/kernel/debug/gled01 holds log2 histograms of the time from the interrupt
+ * to the logged event (irq_latency) and from there to the read() handing it to
+ * user space (read_latency), writing to either clears it, and the counters
+ * (stats).
  */
 
 #include <linux/init.h>
@@ -12,8 +38,34 @@
 #include <linux/fs.h>
 #include <linux/gpio.h>
 #include <linux/interrupt.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/ctype.h>
+#include <linux/kfifo.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/bitops.h>
+#include <linux/gpio/consumer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/eventfd.h>
+#include <linux/list.h>
+#include <linux/leds.h>
+#include <asm/io.h>
 #include <asm/uaccess.h>
 
+#include "gled01.h"
+
+#define CREATE_TRACE_POINTS
+#include "gled01_trace.h"
+
 #define DEVICE_NAME "gled01"
 #define CLASS_NAME "gled01-drv"
 
@@ -22,41 +74,194 @@ MODULE_AUTHOR("Santiago Pagola");
 MODULE_DESCRIPTION("A Button/LED test driver for the BBB");
 MODULE_VERSION("0.1");
 
+#define GLED01_WRITE_MAX  (8)  // Longest write, "1" plus any trailing whitespace e.g. from echo
+#define GLED01_IRQ_FIFO   (32) // Edges queued between the hard IRQ and its thread, a power of 2
+#define GLED01_READ_CHUNK (8)  // Events copied out at a time in dev_read
+#define GLED01_TEXT_MAX   (64) // Longest formatted event, "<press> <led> <timestamp> <duration>\n"
+#define GLED01_BLINK_MS   (500) // Default half period when a trigger leaves it to the driver
+#define GLED01_HIST_BUCKETS (32) // Log2 latency buckets, the last one also counts anything above 2^32ns
+
 static int major_number; //major number to be allocated to the character device
-/** To be on the safe side, let's allocate 3 bytes for this message,
- *  byte 0: holds the future led state,
- *  byte 1: (might) hold an additional newline character that follows
- *  	    if /dev/gled01 is accessed via a shell (e.g. echo 1 > /dev/gled01),
- *	    this could of course be ommited if the -n flag was given to echo,
- *	    but it doesn't hurt to include the possibility for people like me
- *	    who like to type as less as possible :-)
- *  byte 2: zero-termination
- */
-static char message[3] = {0};
 static struct class* gled01Class = NULL;
 static struct device* gled01Dev = NULL;
 static unsigned int gpio_led = 49;// Led to use, on P9_23
 static unsigned int gpio_btn = 115; // Push button to use, on P9_27
-static unsigned int irq_n; // Used to share the IRQ number within this file
-static unsigned int press_cnt = 0; // For information, store the number of button presses
-static unsigned int req_cnt = 0; // Number of read requests from user space
+static int irq_n; // Used to share the IRQ number within this file
+static unsigned int press_cnt = 0; // For information, store the number of button presses, also the head of events
+static struct gled01_event events[GLED01_EVENTS]; // Press n is at (n - 1) % GLED01_EVENTS
+/** A button edge, seen by the hard IRQ */
+struct gled01_edge
+{
+	ktime_t timestamp;
+	bool down; // Button level after the edge
+};
+static DEFINE_KFIFO(irq_fifo, struct gled01_edge, GLED01_IRQ_FIFO); // Edges from the hard IRQ, for the thread
+static unsigned int irq_overruns = 0; // Edges dropped because irq_fifo was full
+static bool btn_down; // Button held down, as last seen by the IRQ thread
+static ktime_t btn_down_at; // When it was pushed down
+static bool btn_led; // LED state the press switched to
+
+static unsigned int debounce_us = 5000;
+module_param(debounce_us, uint, S_IRUGO);
+MODULE_PARM_DESC(debounce_us, " Time the button has to settle after an edge in microseconds, 0 disables debouncing (default=5000)");
+
+static bool sw_debounce; // debounce_us is handled by debounce_timer, the controller could not
+static struct hrtimer debounce_timer;
+static unsigned long debounce_busy; // Bit 0 is set while debounce_timer runs, edges are ignored then
+static ktime_t debounce_start; // Time of the edge that started the window
+static bool debounce_level; // Level the button last settled at
+static unsigned int bounces = 0; // Edges ignored while debouncing
+static unsigned int glitches = 0; // Debounce windows that ended with the button at the level it started from
+static atomic_t req_cnt = ATOMIC_INIT(0); // Number of write requests from user space
 static bool ledOn = 0; // Led state
+static DEFINE_SPINLOCK(led_lock); // Keeps ledOn, the GPIO and the status page in step
+static struct gled01_status *status; // Page mapped read-only by dev_mmap, mirrors ledOn and press_cnt
+static struct hrtimer blink_timer; // Blinks the LED for the LED class, see gled01_blink_set
+static u64 blink_on_ns, blink_off_ns; // Blink times, only changed with blink_timer stopped
+static DECLARE_WAIT_QUEUE_HEAD(btn_wq); // Readers waiting for a button press
+static struct fasync_struct *btn_fasync; // Files to send SIGIO to on new events
+static LIST_HEAD(evfd_readers); // Files with an eventfd bound
+static DEFINE_MUTEX(evfd_lock); // Protects evfd_readers and their eventfds
+
+/** Latency histogram, bucket n counts latencies from 2^n to 2^(n+1) - 1 ns (bucket 0 also 0) */
+struct gled01_hist
+{
+	u32 buckets[GLED01_HIST_BUCKETS];
+	u64 count;
+	u64 sum_ns;
+	u64 max_ns;
+};
+static struct gled01_hist irq_hist;  // Interrupt to event logged by the IRQ thread
+static struct gled01_hist read_hist; // Event logged to event copied by a read
+static DEFINE_SPINLOCK(hist_lock); // Protects both histograms
+static ktime_t events_logged[GLED01_EVENTS]; // When each event of events was logged, for read_hist
+static struct dentry *debug_dir;
+
+/** Per open file state */
+struct gled01_reader
+{
+	struct mutex lock; // Serializes reads sharing this file
+	u32 format;        // GLED01_FORMAT_TEXT or GLED01_FORMAT_BINARY
+	u32 tail;          // Next press this file will read
+	u32 lost;          // Events overwritten before this file read them, or dropped by a faulting read
+	struct gled01_event bounce[GLED01_READ_CHUNK]; // Events on their way to user space
+	ktime_t logged[GLED01_READ_CHUNK];             // When they were logged, for read_hist
+	struct list_head node;    // In evfd_readers while evfd is set
+	struct eventfd_ctx *evfd; // Signalled with the number of new events
+};
 
-// Hander for the IRQ
-static irq_handler_t  btn_irq_handler(unsigned int irq, void *dev_id, struct pt_regs *regs);
+// Handlers for the IRQ, hard and threaded
+static irqreturn_t btn_irq_handler(int irq, void *dev_id);
+static irqreturn_t btn_irq_thread(int irq, void *dev_id);
+static enum hrtimer_restart debounce_timer_cb(struct hrtimer *);
+static bool btn_irq_queue(ktime_t timestamp, bool down);
 
 //File operations
 static int dev_open(struct inode *, struct file *);
 static int dev_release(struct inode *, struct file *);
+static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
 static ssize_t dev_write(struct file *, const char*, size_t, loff_t *);
+static unsigned int dev_poll(struct file *, poll_table *);
+static int dev_mmap(struct file *, struct vm_area_struct *);
+static long dev_ioctl(struct file *, unsigned int, unsigned long);
+static int dev_fasync(int, struct file *, int);
+static int reader_set_eventfd(struct gled01_reader *, int fd);
+static void notify_async(unsigned int n);
+static u32 events_avail(struct gled01_reader *);
+static u32 events_copy(struct gled01_reader *, u32);
+static ssize_t read_text(struct gled01_reader *, char *, size_t);
+static ssize_t read_binary(struct gled01_reader *, char *, size_t);
+
+//Latency histograms
+static void hist_add(struct gled01_hist *, s64 ns);
+static void hist_read_done(const ktime_t *logged, u32 n);
+static void debugfs_setup(void);
+
+//LED state
+static void led_set(bool on);
+static bool led_toggle(void);
+
+//LED class
+static void gled01_brightness_set(struct led_classdev *, enum led_brightness);
+static enum led_brightness gled01_brightness_get(struct led_classdev *);
+static int gled01_blink_set(struct led_classdev *, unsigned long *, unsigned long *);
+static enum hrtimer_restart blink_timer_cb(struct hrtimer *);
+
+static struct led_classdev gled01_led =
+{
+	.name = "gled01::user",
+	.max_brightness = 1,
+	.brightness_set = gled01_brightness_set,
+	.brightness_get = gled01_brightness_get,
+	.blink_set = gled01_blink_set,
+};
+static bool led_registered; // gled01_led was registered
 
 static struct file_operations fops = 
 {
+	.owner = THIS_MODULE,
 	.open = dev_open,
+	.read = dev_read,
 	.write = dev_write,
+	.poll = dev_poll,
+	.mmap = dev_mmap,
+	.unlocked_ioctl = dev_ioctl,
+	.fasync = dev_fasync,
 	.release = dev_release,
 };
 
+/** @function led_show
+ *  @brief Shows the LED state in /sys/class/gled01-drv/gled01/led
+ *  @param dev The gled01 device
+ *  @param attr The attribute
+ *  @param buf The page to print "0\n" or "1\n" to
+ *  @return The number of bytes printed
+ */
+static ssize_t led_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", READ_ONCE(ledOn));
+}
+
+/** @function led_store
+ *  @brief Switches the LED on or off, like writing to /dev/gled01
+ *  @param dev The gled01 device
+ *  @param attr The attribute
+ *  @param buf The new state, 0 or 1
+ *  @param count The length of buf
+ *  @return count on success, -EINVAL otherwise
+ */
+static ssize_t led_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	bool on;
+
+	if (strtobool(buf, &on))
+		return -EINVAL;
+	led_set(on);
+	return count;
+}
+static DEVICE_ATTR_RW(led);
+
+/** @function presses_show
+ *  @brief Shows the number of button presses in /sys/class/gled01-drv/gled01/presses
+ *  @param dev The gled01 device
+ *  @param attr The attribute
+ *  @param buf The page to print the count to
+ *  @return The number of bytes printed
+ */
+static ssize_t presses_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(press_cnt));
+}
+static DEVICE_ATTR_RO(presses);
+
+static struct attribute *gled01_attrs[] =
+{
+	&dev_attr_led.attr,
+	&dev_attr_presses.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(gled01);
+
 /** @function gled01_init
  *  @brief Init function to call when loading the module, which will set up
  *  stuff like the 2 GPIOs to use, register the character device , etc.
@@ -69,30 +274,71 @@ static int __init gled01_init(void){
 		printk(KERN_INFO "GLED01: invalid LED GPIO\n");
 		return -ENODEV;
 	}
+	//Status page, before the IRQ can update it
+	status = (struct gled01_status *)get_zeroed_page(GFP_KERNEL);
+	if (!status)
+		return -ENOMEM;
+	status->version = GLED01_STATUS_VERSION;
+
 	// Going to set up the LED. It is a GPIO in output mode and will be on by default
 	ledOn = true;
-	gpio_request(gpio_led, "sysfs");
+	status->led = ledOn;
+	result = gpio_request(gpio_led, "sysfs");
+	if (result)
+	{
+		printk(KERN_ALERT "GLED01: failed to request the LED GPIO\n");
+		goto out_status;
+	}
 	gpio_direction_output(gpio_led, ledOn);
 	gpio_export(gpio_led, false);
 	//Button on P9_27
-	gpio_request(gpio_btn, "sysfs");
+	result = gpio_request(gpio_btn, "sysfs");
+	if (result)
+	{
+		printk(KERN_ALERT "GLED01: failed to request the button GPIO\n");
+		goto out_led;
+	}
 	gpio_direction_input(gpio_btn);
 	gpio_export(gpio_btn, false);  //Export P9_27
 
 	printk(KERN_INFO "GLED01: Button state: %d\n", gpio_get_value(gpio_btn));
 
+	//Start from the current button level, so that the first edge is a change
+	btn_down = debounce_level = gpio_get_value(gpio_btn);
+	status->button = btn_down;
+	if (btn_down)
+		btn_down_at = ktime_get(); //Held since loading at least, not since boot
+
+	//Debounce in the GPIO controller if it supports it, with the timer otherwise
+	hrtimer_init(&debounce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	debounce_timer.function = debounce_timer_cb;
+	if (debounce_us)
+	{
+		sw_debounce = gpiod_set_debounce(gpio_to_desc(gpio_btn), debounce_us) != 0;
+		printk(KERN_INFO "GLED01: Debouncing the button for %uus in %s\n", debounce_us,
+				sw_debounce ? "software" : "hardware");
+	}
+
 	//gpio number <--> IRQ number mapping
 	irq_n = gpio_to_irq(gpio_btn);
 	printk(KERN_INFO "GLED01: The button is mapped to IRQ: %d\n", irq_n);
+	if (irq_n < 0)
+	{
+		result = irq_n;
+		goto out_btn;
+	}
 
-	// This next call requests an interrupt line
-	result = request_irq(irq_n,
-			(irq_handler_t) btn_irq_handler,
-			IRQF_TRIGGER_RISING,
+	// This next call requests an interrupt line, and a thread for the slow part
+	result = request_threaded_irq(irq_n,
+			btn_irq_handler,
+			btn_irq_thread,
+			IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
 			"btn_gpio_handler",
 			NULL);
 
 	printk(KERN_INFO "GLED01: Interrupt request result: %d\n", result);
+	if (result)
+		goto out_btn;
 
 	//Now register character device
 	//Register major number
@@ -100,7 +346,8 @@ static int __init gled01_init(void){
 	if (major_number<0)
 	{
 		printk(KERN_ALERT "GLED01 failed to register major number\n");
-		return major_number;
+		result = major_number;
+		goto out_irq;
 	}
 	printk(KERN_INFO "GLED01: registered major number %d\n", major_number);
 	
@@ -108,22 +355,49 @@ static int __init gled01_init(void){
 	gled01Class = class_create(THIS_MODULE, CLASS_NAME);
 	if (IS_ERR(gled01Class))
 	{
-		unregister_chrdev(major_number, DEVICE_NAME);
 		printk(KERN_ALERT "Failed to register device class\n");
-		return PTR_ERR(gled01Class);
+		result = PTR_ERR(gled01Class);
+		goto out_chrdev;
 	}
 	printk(KERN_INFO "GLED01: device class successfully registered\n");
 
 	//Register device driver
-	gled01Dev = device_create(gled01Class, NULL, MKDEV(major_number,0), NULL, DEVICE_NAME);
+	gled01Dev = device_create_with_groups(gled01Class, NULL, MKDEV(major_number,0), NULL, gled01_groups, DEVICE_NAME);
 	if (IS_ERR(gled01Dev))
 	{
-		class_destroy(gled01Class);
-		unregister_chrdev(major_number, DEVICE_NAME);
 		printk(KERN_ALERT "Failed to create the device\n");
-		return PTR_ERR(gled01Dev);
+		result = PTR_ERR(gled01Dev);
+		goto out_class;
 	}
 	printk(KERN_INFO "GLED01: device class created successfully\n");
+
+	//The LED class device, the driver works without it
+	hrtimer_init(&blink_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	blink_timer.function = blink_timer_cb;
+	if (led_classdev_register(gled01Dev, &gled01_led))
+		printk(KERN_INFO "GLED01: failed to register the LED class device\n");
+	else
+		led_registered = true;
+	debugfs_setup();
+	return 0;
+
+out_class:
+	class_destroy(gled01Class);
+out_chrdev:
+	unregister_chrdev(major_number, DEVICE_NAME);
+out_irq:
+	disable_irq(irq_n); //No new debounce window, then wait for the last one
+	hrtimer_cancel(&debounce_timer);
+	free_irq(irq_n, NULL);
+out_btn:
+	gpio_unexport(gpio_btn);
+	gpio_free(gpio_btn);
+out_led:
+	gpio_set_value(gpio_led, 0);
+	gpio_unexport(gpio_led);
+	gpio_free(gpio_led);
+out_status:
+	free_page((unsigned long)status);
 	return result;
 }
 
@@ -135,31 +409,51 @@ static int __init gled01_init(void){
  *  @return Nothing
  */
 static void __exit gled01_exit(void){
+	debugfs_remove_recursive(debug_dir);
+	if (led_registered)
+		led_classdev_unregister(&gled01_led); //Also deactivates its trigger
+	hrtimer_cancel(&blink_timer);
 	printk(KERN_INFO "GLED01: Button state: %d\n", gpio_get_value(gpio_btn));
-	printk(KERN_INFO "GLED01: # times pressed: %d\n", press_cnt);
-	gpio_set_value(gpio_led, 0); //Turn off led on exit
-	gpio_unexport(gpio_led); //Unexport it
-	free_irq(irq_n, NULL); //Free the IRQ number
-	gpio_unexport(gpio_btn); // Unexport the Button GPIO
-	gpio_free(gpio_led); // Free the LED GPIO
-	gpio_free(gpio_btn); // Free the Button GPIO
-	//unregister character device
+	printk(KERN_INFO "GLED01: # times pressed: %d, # writes: %d, # presses dropped: %u\n",
+			press_cnt, atomic_read(&req_cnt), irq_overruns);
+	printk(KERN_INFO "GLED01: # bounces ignored: %u, # glitches: %u\n", bounces, glitches);
+	//unregister character device, and with it the led attribute
 	device_destroy(gled01Class, MKDEV(major_number, 0));
 	class_unregister(gled01Class);
 	class_destroy(gled01Class);
 	unregister_chrdev(major_number, DEVICE_NAME);
+	disable_irq(irq_n); //No new debounce window, then wait for the last one
+	hrtimer_cancel(&debounce_timer);
+	free_irq(irq_n, NULL); //Free the IRQ number
+	led_set(false); //Turn off led on exit, nothing can turn it back on now
+	gpio_unexport(gpio_led); //Unexport it
+	gpio_unexport(gpio_btn); // Unexport the Button GPIO
+	gpio_free(gpio_led); // Free the LED GPIO
+	gpio_free(gpio_btn); // Free the Button GPIO
+	free_page((unsigned long)status);
 	printk(KERN_INFO "GLED01: Exiting now\n");
 }
 
 /** @function dev_open
- *  @brief Function to call when opening the device
+ *  @brief Function to call when opening the device, the file reads the presses
+ *  from now on
  *  @param inodep Pointer to the inode struct
  *  @param filep Pointer to the file struct
- *  @return 0, no need to handle anything
+ *  @return 0 on success, -ENOMEM otherwise
  */
 static int dev_open(struct inode* inodep, struct file *filep)
 {
-	printk(KERN_INFO "GLED01: Device opened\n");
+	struct gled01_reader *reader;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+	mutex_init(&reader->lock);
+	INIT_LIST_HEAD(&reader->node);
+	reader->format = GLED01_FORMAT_TEXT;
+	reader->tail = smp_load_acquire(&press_cnt);
+	filep->private_data = reader;
+	trace_gled01_open(reader->tail);
 	return 0;
 }
 
@@ -171,64 +465,707 @@ static int dev_open(struct inode* inodep, struct file *filep)
  */
 static int dev_release(struct inode *inodep, struct file *filep)
 {
-	printk(KERN_INFO "GLED01: Device closed\n");
+	reader_set_eventfd(filep->private_data, -1);
+	dev_fasync(-1, filep, 0);
+	kfree(filep->private_data);
+	trace_gled01_release(READ_ONCE(press_cnt));
+	return 0;
+}
+
+/** @function events_avail
+ *  @brief Number of events the reader has not read yet. A reader that fell more
+ *  than GLED01_EVENTS behind skips to the oldest half of the log still there and
+ *  counts the rest as lost. Called with reader->lock held.
+ *  @param reader The reader
+ *  @return The number of events after its cursor
+ */
+static u32 events_avail(struct gled01_reader *reader)
+{
+	u32 head = smp_load_acquire(&press_cnt);
+
+	if (head - reader->tail > GLED01_EVENTS)
+	{
+		reader->lost += head - GLED01_EVENTS / 2 - reader->tail;
+		reader->tail = head - GLED01_EVENTS / 2;
+	}
+	return head - reader->tail;
+}
+
+/** @function events_copy
+ *  @brief Copies events after the reader's cursor into its bounce buffer and moves
+ *  the cursor past them. The IRQ thread logs events without a lock, so press_cnt is
+ *  checked again once they are copied: events it may have overwritten meanwhile are
+ *  dropped and counted as lost. Called with reader->lock held.
+ *  @param reader The reader
+ *  @param max The most events to copy, at most GLED01_READ_CHUNK
+ *  @return The number of events copied
+ */
+static u32 events_copy(struct gled01_reader *reader, u32 max)
+{
+	u32 i, n, head, torn;
+
+	do
+	{
+		n = min(max, events_avail(reader));
+		for (i = 0; i < n; ++i)
+		{
+			reader->bounce[i] = events[(reader->tail + i) % GLED01_EVENTS];
+			reader->logged[i] = events_logged[(reader->tail + i) % GLED01_EVENTS];
+		}
+		// Only events less than GLED01_EVENTS behind the head were not overwritten meanwhile
+		smp_rmb();
+		head = READ_ONCE(press_cnt);
+		torn = min_t(u32, n, max_t(s32, head - GLED01_EVENTS + 1 - reader->tail, 0));
+		if (torn)
+		{
+			memmove(reader->bounce, reader->bounce + torn, (n - torn) * sizeof(*reader->bounce));
+			memmove(reader->logged, reader->logged + torn, (n - torn) * sizeof(*reader->logged));
+			reader->lost += torn;
+		}
+		reader->tail += n;
+		n -= torn;
+	} while (!n && events_avail(reader));
+	return n;
+}
+
+/** @function dev_read
+ *  @brief Returns as many of the presses since the last read on this file as fit in
+ *  the buffer, in the format selected for this file, waiting for a new press if
+ *  there is none
+ *  @param filep A pointer to the file structure, defined in fs.h
+ *  @param buffer The user-space buffer to copy the events to
+ *  @param len The length of the buffer, room for at least one event
+ *  @param offset An optional offset that may be given
+ *  @return the number of bytes copied, or a negative error code
+ */
+static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *offset)
+{
+	struct gled01_reader *reader = filep->private_data;
+	ktime_t start = trace_gled01_read_enabled() ? ktime_get() : 0;
+	bool binary = reader->format == GLED01_FORMAT_BINARY;
+	ssize_t ret;
+
+	if (len < (binary ? sizeof(struct gled01_event) : GLED01_TEXT_MAX))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&reader->lock))
+		return -ERESTARTSYS;
+again:
+	while (!events_avail(reader))
+	{
+		mutex_unlock(&reader->lock);
+		if (filep->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(btn_wq, smp_load_acquire(&press_cnt) != READ_ONCE(reader->tail)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&reader->lock))
+			return -ERESTARTSYS;
+	}
+	ret = binary ? read_binary(reader, buffer, len) : read_text(reader, buffer, len);
+	if (!ret)
+		goto again; // Everything after the cursor was overwritten while it was copied
+	trace_gled01_read(reader->tail, ret, start);
+	mutex_unlock(&reader->lock);
+	return ret;
+}
+
+/** @function read_text
+ *  @brief Formats as many events as fit in the buffer, one
+ *  "<press> <led> <timestamp> <duration>\n" line each. Called with reader->lock held.
+ *  @param reader The reader, its cursor is moved past the copied events
+ *  @param buffer The user-space buffer
+ *  @param len The length of the buffer
+ *  @return the number of bytes copied, or a negative error code
+ */
+static ssize_t read_text(struct gled01_reader *reader, char *buffer, size_t len)
+{
+	char text[GLED01_READ_CHUNK * GLED01_TEXT_MAX + 1];
+	const struct gled01_event *ev;
+	unsigned int i, n;
+	size_t size;
+	ssize_t copied = 0;
+	int err = 0;
+
+	while (len - copied >= GLED01_TEXT_MAX)
+	{
+		n = events_copy(reader, min_t(size_t, GLED01_READ_CHUNK, (len - copied) / GLED01_TEXT_MAX));
+		if (!n)
+			break;
+		for (i = 0, size = 0; i < n; ++i)
+		{
+			ev = &reader->bounce[i];
+			size += sprintf(text + size, "%u %u %lld %llu\n", ev->press, ev->led, ev->timestamp, ev->duration_ns);
+		}
+		if (copy_to_user(buffer + copied, text, size))
+		{
+			reader->lost += n; // Already past the cursor
+			err = -EFAULT;
+			break;
+		}
+		hist_read_done(reader->logged, n);
+		copied += size;
+	}
+	return copied ? copied : err;
+}
+
+/** @function read_binary
+ *  @brief Copies as many whole struct gled01_event records as fit in the buffer,
+ *  GLED01_READ_CHUNK at a time through the bounce buffer. Called with reader->lock held.
+ *  @param reader The reader, its cursor is moved past the copied events
+ *  @param buffer The user-space buffer
+ *  @param len The length of the buffer
+ *  @return the number of bytes copied, or a negative error code
+ */
+static ssize_t read_binary(struct gled01_reader *reader, char *buffer, size_t len)
+{
+	const size_t rec = sizeof(struct gled01_event);
+	ssize_t copied = 0;
+	int err = 0;
+	u32 n;
+
+	while (len - copied >= rec)
+	{
+		n = events_copy(reader, min_t(size_t, GLED01_READ_CHUNK, (len - copied) / rec));
+		if (!n)
+			break;
+		if (copy_to_user(buffer + copied, reader->bounce, n * rec))
+		{
+			reader->lost += n; // Already past the cursor
+			err = -EFAULT;
+			break;
+		}
+		hist_read_done(reader->logged, n);
+		copied += n * rec;
+	}
+	return copied ? copied : err;
+}
+
+/** @function dev_poll
+ *  @brief Reports the device as readable while there are presses this file has not
+ *  read. The IRQ thread wakes up btn_wq after logging presses.
+ *  @param filep A pointer to the file structure, defined in fs.h
+ *  @param wait The poll table to register btn_wq with
+ *  @return POLLIN | POLLRDNORM with events to read, 0 otherwise
+ */
+static unsigned int dev_poll(struct file *filep, poll_table *wait)
+{
+	struct gled01_reader *reader = filep->private_data;
+
+	poll_wait(filep, &btn_wq, wait);
+	if (smp_load_acquire(&press_cnt) != READ_ONCE(reader->tail))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+/** @function dev_fasync
+ *  @brief Adds the file to or removes it from the files getting SIGIO on new events
+ *  @param fd The file descriptor
+ *  @param filep A pointer to the file structure, defined in fs.h
+ *  @param on Whether O_ASYNC is being set
+ *  @return The result of fasync_helper
+ */
+static int dev_fasync(int fd, struct file *filep, int on)
+{
+	return fasync_helper(fd, filep, on, &btn_fasync);
+}
+
+/** @function reader_set_eventfd
+ *  @brief Binds an eventfd to a file, replacing the one bound before if any
+ *  @param reader The file's reader
+ *  @param fd The eventfd, -1 to only unbind
+ *  @return 0 on success, the error of eventfd_ctx_fdget otherwise
+ */
+static int reader_set_eventfd(struct gled01_reader *reader, int fd)
+{
+	struct eventfd_ctx *evfd = NULL;
+
+	if (fd >= 0)
+	{
+		evfd = eventfd_ctx_fdget(fd);
+		if (IS_ERR(evfd))
+			return PTR_ERR(evfd);
+	}
+	mutex_lock(&evfd_lock);
+	if (reader->evfd)
+	{
+		eventfd_ctx_put(reader->evfd);
+		list_del_init(&reader->node);
+	}
+	reader->evfd = evfd;
+	if (evfd)
+		list_add(&reader->node, &evfd_readers);
+	mutex_unlock(&evfd_lock);
+	return 0;
+}
+
+/** @function notify_async
+ *  @brief Tells the files that asked for it about new events, with SIGIO or their eventfd
+ *  @param n The number of new events
+ */
+static void notify_async(unsigned int n)
+{
+	struct gled01_reader *reader;
+
+	kill_fasync(&btn_fasync, SIGIO, POLL_IN);
+	mutex_lock(&evfd_lock);
+	list_for_each_entry(reader, &evfd_readers, node)
+		eventfd_signal(reader->evfd, n);
+	mutex_unlock(&evfd_lock);
+}
+
+/** @function dev_ioctl
+ *  @brief Per file settings, see gled01.h
+ *  @param filep A pointer to the file structure, defined in fs.h
+ *  @param cmd GLED01_IOC_SET_FORMAT, GLED01_IOC_GET_LOST or GLED01_IOC_SET_EVENTFD
+ *  @param arg Pointer to a __u32 (__s32 for GLED01_IOC_SET_EVENTFD) in user space holding
+ *  the new value, or receiving the current one
+ *  @return 0 on success, -EFAULT, -EINVAL, -EBADF or -ENOTTY otherwise
+ */
+static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+	struct gled01_reader *reader = filep->private_data;
+	s32 fd;
+	u32 val;
+
+	switch (cmd)
+	{
+		case GLED01_IOC_SET_FORMAT:
+			if (get_user(val, (u32 __user *)arg))
+				return -EFAULT;
+			if (val != GLED01_FORMAT_TEXT && val != GLED01_FORMAT_BINARY)
+				return -EINVAL;
+			mutex_lock(&reader->lock);
+			reader->format = val;
+			mutex_unlock(&reader->lock);
+			return 0;
+		case GLED01_IOC_GET_LOST:
+			mutex_lock(&reader->lock);
+			events_avail(reader); // Account for what was overwritten up to now
+			val = reader->lost;
+			mutex_unlock(&reader->lock);
+			return put_user(val, (u32 __user *)arg);
+		case GLED01_IOC_SET_EVENTFD:
+			if (get_user(fd, (s32 __user *)arg))
+				return -EFAULT;
+			return reader_set_eventfd(reader, fd);
+		default:
+			return -ENOTTY;
+	}
+}
+
+/** @function dev_mmap
+ *  @brief Maps the status page read-only, see struct gled01_status in gled01.h
+ *  @param filep A pointer to the file structure, defined in fs.h
+ *  @param vma The user mapping, a single page at offset 0
+ *  @return 0 on success, -EPERM for writable mappings, -EINVAL or -EAGAIN otherwise
+ */
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_pfn_range(vma, vma->vm_start, virt_to_phys(status) >> PAGE_SHIFT,
+			PAGE_SIZE, vma->vm_page_prot);
+}
+
+/** @function led_set
+ *  @brief Switches the LED on or off. Writers, sysfs and the IRQ handler may race,
+ *  led_lock makes sure the GPIO ends up in the state they agree on.
+ *  @param on The new state
+ */
+static void led_set(bool on)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&led_lock, flags);
+	ledOn = on;
+	gpio_set_value(gpio_led, on);
+	WRITE_ONCE(status->led, on);
+	spin_unlock_irqrestore(&led_lock, flags);
+}
+
+/** @function led_toggle
+ *  @brief Inverts the LED state, see led_set
+ *  @return The new state
+ */
+static bool led_toggle(void)
+{
+	unsigned long flags;
+	bool on;
+
+	spin_lock_irqsave(&led_lock, flags);
+	on = ledOn = !ledOn;
+	gpio_set_value(gpio_led, on);
+	WRITE_ONCE(status->led, on);
+	spin_unlock_irqrestore(&led_lock, flags);
+	return on;
+}
+
+/** @function gled01_brightness_set
+ *  @brief Switches the LED for the LED class, also stopping a blink started by
+ *  gled01_blink_set. May be called in atomic context, e.g. by triggers.
+ *  @param cdev The LED class device
+ *  @param brightness LED_OFF or anything else for on
+ */
+static void gled01_brightness_set(struct led_classdev *cdev, enum led_brightness brightness)
+{
+	hrtimer_cancel(&blink_timer);
+	led_set(brightness != LED_OFF);
+}
+
+/** @function gled01_brightness_get
+ *  @brief Reports the LED state, which the button and writes change as well
+ *  @param cdev The LED class device
+ *  @return 1 while the LED is on, LED_OFF otherwise
+ */
+static enum led_brightness gled01_brightness_get(struct led_classdev *cdev)
+{
+	return READ_ONCE(ledOn) ? 1 : LED_OFF;
+}
+
+/** @function gled01_blink_set
+ *  @brief Blinks the LED from blink_timer, so that the timer trigger needs neither
+ *  user space nor the LED core's jiffies timer
+ *  @param cdev The LED class device
+ *  @param delay_on Time on in ms, set to GLED01_BLINK_MS if both are 0
+ *  @param delay_off Time off in ms, likewise
+ *  @return 0
+ */
+static int gled01_blink_set(struct led_classdev *cdev, unsigned long *delay_on, unsigned long *delay_off)
+{
+	if (!*delay_on && !*delay_off)
+		*delay_on = *delay_off = GLED01_BLINK_MS;
+	hrtimer_cancel(&blink_timer);
+	blink_on_ns = (u64)*delay_on * NSEC_PER_MSEC;
+	blink_off_ns = (u64)*delay_off * NSEC_PER_MSEC;
+	led_set(blink_on_ns != 0);
+	if (blink_on_ns && blink_off_ns)
+		hrtimer_start(&blink_timer, ns_to_ktime(blink_on_ns), HRTIMER_MODE_REL);
 	return 0;
 }
 
+/** @function blink_timer_cb
+ *  @brief Ends the on or off half of a blink
+ *  @param timer The hrtimer that expired (blink_timer)
+ *  @return HRTIMER_RESTART, the timer is only stopped by the LED class callbacks
+ */
+static enum hrtimer_restart blink_timer_cb(struct hrtimer *timer)
+{
+	u64 next = led_toggle() ? blink_on_ns : blink_off_ns;
+
+	hrtimer_forward_now(timer, ns_to_ktime(next));
+	return HRTIMER_RESTART;
+}
+
 /** @function dev_write
- *  @brief Write function used to write data from user-space to this character device
- *  Note the use of copy_from_user function, since we need to copy the data coming from
- *  user-space (i.e. buffer) to our static array "message" in order to be able to use it
+ *  @brief Write function used to write data from user-space to this character device.
+ *  "0" or "1", optionally followed by whitespace (e.g. echo 1 > /dev/gled01), switches
+ *  the LED off or on. The data is copied to the caller's stack, so any number of
+ *  writers can run at the same time.
  *  @param filep A pointer to the file structure, defined in fs.h
  *  @param buffer The data coming from user-space
  *  @param len Then length of the copied bytes from user-space
  *  @param offset An optional offset that may be given
- *  @return the number of bytes copied to the character device
+ *  @return the number of bytes copied to the character device, -EFAULT or -EINVAL otherwise
  */
 static ssize_t dev_write(struct file *filep, const char* buffer, size_t len, loff_t *offset)
 {
+	ktime_t start = trace_gled01_write_enabled() ? ktime_get() : 0;
+	char message[GLED01_WRITE_MAX];
+	size_t i;
+
 	//Some data was written from user space
-	printk(KERN_INFO "Received buffer size: %d\n", len);
-	int err = 0;
-	err = copy_from_user(message, buffer, len);
-	message[len] = 0;
-	printk(KERN_INFO "Received led status is: [%c]\n", message[0]);
-	if (message[0] == '0')
+	if (!len || len > sizeof(message))
+		return -EINVAL;
+	if (copy_from_user(message, buffer, len))
+		return -EFAULT;
+	for (i = 1; i < len; ++i)
 	{
-		gpio_set_value(gpio_led, false);
-		ledOn = false;
+		if (!isspace(message[i]) && message[i] != '\0')
+			break;
 	}
-	else if (message[0] == '1')
+	if (i < len || (message[0] != '0' && message[0] != '1'))
 	{
-		gpio_set_value(gpio_led, true);
-		ledOn = true;
+		pr_debug("GLED01: Unknown stream received (%zu bytes)\n", len);
+		return -EINVAL;
+	}
+	led_set(message[0] == '1');
+	atomic_inc(&req_cnt);
+	trace_gled01_write(message[0], len, message[0] == '1', start);
+	return len;
+}
+
+/** @function btn_irq_queue
+ *  @brief Hands a button edge to btn_irq_thread. irq_fifo has a single producer
+ *  (btn_irq_handler, or debounce_timer_cb when debouncing in software) and a single
+ *  consumer (the thread), so it needs no lock.
+ *  @param timestamp When the edge happened
+ *  @param down The button level after it
+ *  @return true if the edge was queued, false if irq_fifo was full
+ */
+static bool btn_irq_queue(ktime_t timestamp, bool down)
+{
+	struct gled01_edge edge = { .timestamp = timestamp, .down = down };
+
+	if (kfifo_put(&irq_fifo, edge))
+		return true;
+	irq_overruns++;
+	return false;
+}
+
+/** @function btn_irq_handler
+ *  @brief The GPIO IRQ Handler function
+ *  Runs in hard IRQ context on both edges, so it only timestamps the edge and
+ *  queues it with the button level for btn_irq_thread. With software debouncing
+ *  the first edge starts the debounce window instead and the others are ignored.
+ *  @param irq    the IRQ number that is associated with the GPIO
+ *  @param dev_id the *dev_id that is provided, NULL here
+ *  @return IRQ_WAKE_THREAD to have the edge handled by btn_irq_thread, IRQ_HANDLED
+ *  while debouncing
+ */
+static irqreturn_t btn_irq_handler(int irq, void *dev_id)
+{
+	ktime_t now = ktime_get();
+
+	if (sw_debounce)
+	{
+		if (test_and_set_bit(0, &debounce_busy))
+		{
+			bounces++;
+			return IRQ_HANDLED;
+		}
+		debounce_start = now;
+		hrtimer_start(&debounce_timer, ns_to_ktime((u64)debounce_us * NSEC_PER_USEC), HRTIMER_MODE_REL);
+		return IRQ_HANDLED;
+	}
+	return btn_irq_queue(now, gpio_get_value(gpio_btn)) ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+/** @function debounce_timer_cb
+ *  @brief Ends a debounce window: if the button settled at the other level, the
+ *  edge that started the window is handed to btn_irq_thread like an undebounced one
+ *  @param timer The hrtimer that expired (debounce_timer)
+ *  @return HRTIMER_NORESTART, the next edge starts a new window
+ */
+static enum hrtimer_restart debounce_timer_cb(struct hrtimer *timer)
+{
+	bool level = gpio_get_value(gpio_btn);
+
+	if (level != debounce_level)
+	{
+		debounce_level = level;
+		if (btn_irq_queue(debounce_start, level))
+			irq_wake_thread(irq_n, NULL);
 	}
 	else
 	{
-		printk(KERN_INFO "Unknown stream received: %s\n", buffer);
+		glitches++;
+	}
+	clear_bit(0, &debounce_busy);
+	return HRTIMER_NORESTART;
+}
+
+/** @function btn_irq_thread
+ *  @brief Threaded part of the IRQ handler: toggles the LED when the button goes
+ *  down and logs the press with its duration when it comes back up, then wakes up
+ *  readers and pollers once for all the queued edges. Repeated levels, from an edge
+ *  lost to a full irq_fifo, are ignored.
+ *  @param irq    the IRQ number that is associated with the GPIO
+ *  @param dev_id the *dev_id that is provided, NULL here
+ *  @return IRQ_HANDLED
+ */
+static irqreturn_t btn_irq_thread(int irq, void *dev_id)
+{
+	struct gled01_event *ev;
+	struct gled01_edge edge;
+	unsigned int logged = 0;
+	ktime_t now;
+	bool on;
+
+	while (kfifo_get(&irq_fifo, &edge))
+	{
+		if (edge.down == btn_down)
+			continue;
+		btn_down = edge.down;
+		WRITE_ONCE(status->button, btn_down);
+		now = ktime_get();
+		hist_add(&irq_hist, ktime_to_ns(ktime_sub(now, edge.timestamp)));
+		if (btn_down)
+		{
+			btn_down_at = edge.timestamp;
+			btn_led = led_toggle();    // Invert the LED state on each button press
+			continue;
+		}
+		on = btn_led;
+		ev = &events[press_cnt % GLED01_EVENTS];
+		ev->timestamp = ktime_to_ns(btn_down_at);
+		ev->duration_ns = ktime_to_ns(ktime_sub(edge.timestamp, btn_down_at));
+		ev->press = press_cnt + 1;
+		ev->led = on;
+		events_logged[press_cnt % GLED01_EVENTS] = now;
+		smp_store_release(&press_cnt, press_cnt + 1); // Publish the event to readers
+		WRITE_ONCE(status->presses, press_cnt);
+		trace_gled01_irq(irq, on, press_cnt);
+		logged++;
+	}
+	wake_up_interruptible(&btn_wq);      // Let readers and pollers know
+	if (logged)
+		notify_async(logged);
+	return IRQ_HANDLED;
+}
+
+/** @function hist_add
+ *  @brief Counts one latency in a histogram
+ *  @param hist The histogram
+ *  @param ns The latency in ns
+ */
+static void hist_add(struct gled01_hist *hist, s64 ns)
+{
+	unsigned int bucket;
+
+	if (ns < 0)
+		ns = 0;
+	bucket = ns ? fls64(ns) - 1 : 0;
+	bucket = min_t(unsigned int, bucket, GLED01_HIST_BUCKETS - 1);
+	spin_lock(&hist_lock);
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sum_ns += ns;
+	hist->max_ns = max_t(u64, hist->max_ns, ns);
+	spin_unlock(&hist_lock);
+}
+
+/** @function hist_read_done
+ *  @brief Counts the time since they were logged for events just copied to user space
+ *  @param logged When each of them was logged
+ *  @param n The number of events
+ */
+static void hist_read_done(const ktime_t *logged, u32 n)
+{
+	ktime_t now = ktime_get();
+	u32 i;
+
+	for (i = 0; i < n; ++i)
+		hist_add(&read_hist, ktime_to_ns(ktime_sub(now, logged[i])));
+}
+
+/** @function hist_show
+ *  @brief Prints a histogram as a summary line and a line per bucket up to the last used one
+ *  @param m The seq_file, its private data is the histogram
+ *  @param v Unused
+ *  @return 0
+ */
+static int hist_show(struct seq_file *m, void *v)
+{
+	struct gled01_hist hist;
+	int i, last = -1;
+
+	spin_lock(&hist_lock);
+	hist = *(struct gled01_hist *)m->private;
+	spin_unlock(&hist_lock);
+
+	seq_printf(m, "count %llu avg_ns %llu max_ns %llu\n", hist.count,
+			hist.count ? div64_u64(hist.sum_ns, hist.count) : 0, hist.max_ns);
+	for (i = 0; i < GLED01_HIST_BUCKETS; ++i)
+	{
+		if (hist.buckets[i])
+			last = i;
 	}
-	++req_cnt;
-	printk(KERN_INFO "Request number: %d\n", req_cnt);
+	for (i = 0; i <= last; ++i)
+		seq_printf(m, "%12llu ns: %u\n", i ? 1ULL << i : 0, hist.buckets[i]);
+	return 0;
+}
+
+/** @function hist_open
+ *  @brief Opens a histogram file, the inode's private data is the histogram
+ *  @param inode The debugfs inode
+ *  @param file The file
+ *  @return 0 on success, -ENOMEM otherwise
+ */
+static int hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hist_show, inode->i_private);
+}
+
+/** @function hist_clear
+ *  @brief Clears a histogram on any write to its file
+ *  @param file The debugfs file
+ *  @param buf The data written, ignored
+ *  @param len Its length
+ *  @param ppos The file position
+ *  @return len
+ */
+static ssize_t hist_clear(struct file *file, const char __user *buf, size_t len, loff_t *ppos)
+{
+	struct gled01_hist *hist = ((struct seq_file *)file->private_data)->private;
+
+	spin_lock(&hist_lock);
+	memset(hist, 0, sizeof(*hist));
+	spin_unlock(&hist_lock);
 	return len;
 }
 
-/** @function btn_irq_handler
- *  @brief The GPIO IRQ Handler function
- *  This function is a custom interrupt handler that is attached to the GPIO above. The same interrupt
- *  handler cannot be invoked concurrently as the interrupt line is masked out until the function is complete.
- *  This function is static as it should not be invoked directly from outside of this file.
- *  @param irq    the IRQ number that is associated with the GPIO -- useful for logging.
- *  @param dev_id the *dev_id that is provided -- can be used to identify which device caused the interrupt
- *  Not used in this example as NULL is passed.
- *  @param regs   h/w specific register values -- only really ever used for debugging.
- *  return returns IRQ_HANDLED if successful -- should return IRQ_NONE otherwise.
- */
-static irq_handler_t btn_irq_handler(unsigned int irq, void *dev_id, struct pt_regs *regs){
-	ledOn = !ledOn;                          // Invert the LED state on each button press
-	gpio_set_value(gpio_led, ledOn);          // Set the physical LED accordingly
-	printk(KERN_INFO "GLED01: Interrupt! (button state is %d)\n", ledOn);
-	press_cnt++;                         // Global counter, will be outputted when the module is unloaded
-	return (irq_handler_t) IRQ_HANDLED;      // Announce that the IRQ has been handled correctly
+static const struct file_operations hist_fops =
+{
+	.owner = THIS_MODULE,
+	.open = hist_open,
+	.read = seq_read,
+	.write = hist_clear,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/** @function stats_show
+ *  @brief Prints the counters that are otherwise only printed when unloading
+ *  @param m The seq_file
+ *  @param v Unused
+ *  @return 0
+ */
+static int stats_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "presses %u\nwrites %d\ndropped %u\nbounces %u\nglitches %u\n",
+			READ_ONCE(press_cnt), atomic_read(&req_cnt), READ_ONCE(irq_overruns),
+			READ_ONCE(bounces), READ_ONCE(glitches));
+	return 0;
+}
+
+/** @function stats_open
+ *  @brief Opens the stats file
+ *  @param inode The debugfs inode
+ *  @param file The file
+ *  @return 0 on success, -ENOMEM otherwise
+ */
+static int stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stats_show, NULL);
+}
+
+static const struct file_operations stats_fops =
+{
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/** @function debugfs_setup
+ *  @brief Creates /sys/kernel/debug/gled01. The driver works without it, so
+ *  failures are ignored.
+ */
+static void debugfs_setup(void)
+{
+	debug_dir = debugfs_create_dir(DEVICE_NAME, NULL);
+	if (IS_ERR_OR_NULL(debug_dir))
+	{
+		debug_dir = NULL;
+		return;
+	}
+	debugfs_create_file("irq_latency", 0644, debug_dir, &irq_hist, &hist_fops);
+	debugfs_create_file("read_latency", 0644, debug_dir, &read_hist, &hist_fops);
+	debugfs_create_file("stats", 0444, debug_dir, NULL, &stats_fops);
 }
 
 /// This next calls are  mandatory -- they identify the initialization function
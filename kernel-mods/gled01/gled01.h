@@ -0,0 +1,62 @@
+/**
+ * @file   gled01.h
+ * @author Santiago Pagola
+ * @license GPL
+ * @brief  Definitions shared between the gled01 driver and user space.
+ *
+ * Every button press is an event, logged when the button is released with the
+ * time it was pushed down and how long it was held, both taken in the interrupt
+ * handler. Each open file reads the events since it was opened, as many as fit
+ * per read(): "<press> <led> <timestamp> <duration>\n" lines by default, or
+ * whole struct gled01_event records after GLED01_IOC_SET_FORMAT with
+ * GLED01_FORMAT_BINARY. The driver keeps the last GLED01_EVENTS events,
+ * GLED01_IOC_GET_LOST reports how many a file missed by falling further behind,
+ * including events overwritten while read() copied them, which it never returns.
+ *
+ * Event loops can be told about new events without a blocked reader: with
+ * O_ASYNC (fcntl F_SETOWN and F_SETFL) the driver sends SIGIO, and
+ * GLED01_IOC_SET_EVENTFD binds an eventfd to the file that the driver adds
+ * the number of new events to. Passing -1 unbinds it.
+ *
+ * mmap() of one page at offset 0 of /dev/gled01 gives a read-only struct
+ * gled01_status kept up to date by the driver, so the LED and the button can
+ * be watched with plain memory loads. The LED and the press count are also in
+ * /sys/class/gled01-drv/gled01/led and presses.
+ */
+
+#ifndef _GLED01_H_
+#define _GLED01_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define GLED01_STATUS_VERSION (2)
+#define GLED01_EVENTS         (256) /*!< events kept for slow readers */
+
+/* read() formats */
+#define GLED01_FORMAT_TEXT   (0) /*!< "<press> <led> <timestamp> <duration>\n" per event */
+#define GLED01_FORMAT_BINARY (1) /*!< struct gled01_event per event */
+
+/* ioctl commands */
+#define GLED01_IOC_MAGIC      'g'
+#define GLED01_IOC_SET_FORMAT _IOW(GLED01_IOC_MAGIC, 1, __u32)
+#define GLED01_IOC_GET_LOST   _IOR(GLED01_IOC_MAGIC, 2, __u32)
+#define GLED01_IOC_SET_EVENTFD _IOW(GLED01_IOC_MAGIC, 3, __s32)
+
+/** One button press */
+struct gled01_event {
+	__s64 timestamp;   /*!< CLOCK_MONOTONIC time the button was pushed down, in ns */
+	__u64 duration_ns; /*!< time it was held down */
+	__u32 press;       /*!< number of the press, the first one is 1 */
+	__u32 led;         /*!< LED state the press switched to */
+};
+
+/** Status page, at offset 0 of the mapping */
+struct gled01_status {
+	__u32 version; /*!< GLED01_STATUS_VERSION */
+	__u32 led;     /*!< 1 while the LED is on */
+	__u32 presses; /*!< button presses so far */
+	__u32 button;  /*!< 1 while the button is held down */
+};
+
+#endif /* _GLED01_H_ */
@@ -0,0 +1,107 @@
+/**
+ * @file   gled01_trace.h
+ * @author Santiago Pagola
+ * @license GPL
+ * @brief  Tracepoints of the gled01 driver, in the gled01 trace system.
+ *
+ * Enable them with e.g.
+ *   echo 1 > /sys/kernel/debug/tracing/events/gled01/enable
+ * or record them with perf record -e 'gled01:*'. They cost a patched-out
+ * branch while disabled.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM gled01
+
+#if !defined(_GLED01_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _GLED01_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+DECLARE_EVENT_CLASS(gled01_file,
+	TP_PROTO(unsigned int presses),
+	TP_ARGS(presses),
+	TP_STRUCT__entry(
+		__field(unsigned int, presses)
+	),
+	TP_fast_assign(
+		__entry->presses = presses;
+	),
+	TP_printk("presses=%u", __entry->presses)
+);
+
+/** /dev/gled01 opened, with the button presses so far */
+DEFINE_EVENT(gled01_file, gled01_open,
+	TP_PROTO(unsigned int presses),
+	TP_ARGS(presses)
+);
+
+/** /dev/gled01 closed, with the button presses so far */
+DEFINE_EVENT(gled01_file, gled01_release,
+	TP_PROTO(unsigned int presses),
+	TP_ARGS(presses)
+);
+
+/** A read returned, including the time it spent waiting for a press */
+TRACE_EVENT(gled01_read,
+	TP_PROTO(unsigned int presses, ssize_t ret, ktime_t start),
+	TP_ARGS(presses, ret, start),
+	TP_STRUCT__entry(
+		__field(unsigned int, presses)
+		__field(ssize_t, ret)
+		__field(s64, latency_ns)
+	),
+	TP_fast_assign(
+		__entry->presses = presses;
+		__entry->ret = ret;
+		__entry->latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	),
+	TP_printk("presses=%u ret=%zd latency_ns=%lld",
+		__entry->presses, __entry->ret, __entry->latency_ns)
+);
+
+/** A write was handled: the command character and the resulting LED state */
+TRACE_EVENT(gled01_write,
+	TP_PROTO(char cmd, size_t len, bool led, ktime_t start),
+	TP_ARGS(cmd, len, led, start),
+	TP_STRUCT__entry(
+		__field(char, cmd)
+		__field(size_t, len)
+		__field(bool, led)
+		__field(s64, latency_ns)
+	),
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->len = len;
+		__entry->led = led;
+		__entry->latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	),
+	TP_printk("cmd='%c' len=%zu led=%d latency_ns=%lld",
+		__entry->cmd, __entry->len, __entry->led, __entry->latency_ns)
+);
+
+/** The button IRQ toggled the LED */
+TRACE_EVENT(gled01_irq,
+	TP_PROTO(int irq, bool led, unsigned int presses),
+	TP_ARGS(irq, led, presses),
+	TP_STRUCT__entry(
+		__field(int, irq)
+		__field(bool, led)
+		__field(unsigned int, presses)
+	),
+	TP_fast_assign(
+		__entry->irq = irq;
+		__entry->led = led;
+		__entry->presses = presses;
+	),
+	TP_printk("irq=%d led=%d presses=%u", __entry->irq, __entry->led, __entry->presses)
+);
+
+#endif /* _GLED01_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE gled01_trace
+#include <trace/define_trace.h>
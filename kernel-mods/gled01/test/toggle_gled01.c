@@ -4,6 +4,13 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+
+#include "../gled01.h"
 
 int fd; //File descriptor
 
@@ -20,6 +27,64 @@ void sig_handler(int signo)
 	}
 }
 
+/* Print the button presses as they come, as binary events */
+int show_events()
+{
+	struct gled01_event ev[16];
+	__u32 format = GLED01_FORMAT_BINARY;
+	__u32 lost;
+	int ret, i;
+
+	if (ioctl(fd, GLED01_IOC_SET_FORMAT, &format) < 0)
+	{
+		perror("Error selecting binary events");
+		close(fd);
+		return errno;
+	}
+	while ((ret = read(fd, ev, sizeof(ev))) > 0)
+	{
+		for (i = 0; i < ret / (int)sizeof(ev[0]); ++i)
+			printf("press %u at %lld.%09lld held for %llu us, led %u\n", ev[i].press,
+					ev[i].timestamp / 1000000000, ev[i].timestamp % 1000000000,
+					(unsigned long long)ev[i].duration_ns / 1000, ev[i].led);
+		if (ioctl(fd, GLED01_IOC_GET_LOST, &lost) == 0 && lost)
+			printf("%u presses lost\n", lost);
+	}
+	perror("Error reading from device");
+	close(fd);
+	return errno;
+}
+
+/* Wait for presses on an eventfd bound to the device, then read them without blocking */
+int wait_eventfd()
+{
+	char line[256];
+	uint64_t n;
+	int efd, ret;
+
+	efd = eventfd(0, 0);
+	if (efd < 0 || ioctl(fd, GLED01_IOC_SET_EVENTFD, &efd) < 0)
+	{
+		perror("Error binding an eventfd");
+		close(fd);
+		return errno;
+	}
+	while (read(efd, &n, sizeof(n)) == sizeof(n))
+	{
+		printf("eventfd: %llu new presses\n", (unsigned long long)n);
+		ret = read(fd, line, sizeof(line) - 1);
+		if (ret > 0)
+		{
+			line[ret] = 0;
+			printf("%s", line);
+		}
+	}
+	perror("Error reading the eventfd");
+	close(efd);
+	close(fd);
+	return errno;
+}
+
 int main(int argc, char* argv[])
 {
 	int ret;
@@ -37,6 +102,14 @@ int main(int argc, char* argv[])
 		perror("Failed to open device");
 		return errno;
 	}
+	if (argc > 1 && !strcmp(argv[1], "-e"))
+	{
+		return show_events();
+	}
+	if (argc > 1 && !strcmp(argv[1], "-f"))
+	{
+		return wait_eventfd();
+	}
 	
 	while (1)
 	{
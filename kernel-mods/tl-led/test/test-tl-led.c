@@ -4,10 +4,128 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "../tl-led.h"
 
 void help()
 {
-	fprintf(stderr, "USAGE: ./test-tl-led LEDNR:STATE, with LEDNR={0|1|2} and STATE={0|1}\n");
+	fprintf(stderr, "USAGE: ./test-tl-led LEDNR:STATE [LEDNR:STATE ...], with LEDNR={0..%d} and STATE={0|1}\n", TLLED_MAX_LEDS - 1);
+	fprintf(stderr, "All the LEDs given are set at once, with a single write\n");
+	fprintf(stderr, "       ./test-tl-led -p REPEAT MASK:US [MASK:US ...], plays a pattern in the kernel, REPEAT=0 for ever\n");
+	fprintf(stderr, "       ./test-tl-led -s, stops the pattern\n");
+	fprintf(stderr, "       ./test-tl-led -b LEDNR LEVEL, sets the brightness of an LED, LEVEL=0..%d\n", TLLED_MAX_BRIGHTNESS);
+	fprintf(stderr, "       ./test-tl-led -r, shows the LED state from read() and from the status page\n");
+}
+
+/* Show the LED state, once as read() returns it and once from the mapped status page */
+int show_state()
+{
+	const struct tlled_status *status;
+	char line[128];
+	int fd, ret;
+
+	fd = open("/dev/tl-led", O_RDONLY);
+	if (fd < 0)
+	{
+		perror("Failed to open device");
+		return errno;
+	}
+	ret = read(fd, line, sizeof(line) - 1);
+	if (ret < 0)
+	{
+		perror("Error reading from device");
+		close(fd);
+		return errno;
+	}
+	line[ret] = 0;
+	printf("read(): %s", line);
+	status = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	if (status == MAP_FAILED)
+	{
+		perror("Error mapping the status page");
+		close(fd);
+		return errno;
+	}
+	printf("status page: version %u, %u LEDs, leds 0x%x, %u changes\n",
+			status->version, status->num_leds, status->leds, status->changes);
+	munmap((void *)status, sysconf(_SC_PAGESIZE));
+	close(fd);
+	return 0;
+}
+
+/* Set the brightness of an LED */
+int set_brightness(const char *led, const char *level)
+{
+	struct tlled_brightness brightness;
+	int fd, ret;
+
+	brightness.led = strtoul(led, NULL, 0);
+	brightness.level = strtoul(level, NULL, 0);
+	fd = open("/dev/tl-led", O_RDWR);
+	if (fd < 0)
+	{
+		perror("Failed to open device");
+		return errno;
+	}
+	ret = ioctl(fd, TLLED_IOC_SET_BRIGHTNESS, &brightness);
+	if (ret < 0)
+	{
+		perror("Error setting the brightness");
+		close(fd);
+		return errno;
+	}
+	close(fd);
+	return 0;
+}
+
+/* Upload a pattern of MASK:US steps, or stop the one being played if there are none */
+int play_pattern(int argc, char* argv[])
+{
+	struct tlled_pattern_step steps[TLLED_MAX_STEPS];
+	struct tlled_pattern pattern;
+	int fd, ret, i;
+
+	if (argc > TLLED_MAX_STEPS + 1)
+	{
+		help();
+		return -1;
+	}
+	for (i = 1; i < argc; ++i)
+	{
+		if (sscanf(argv[i], "%x:%u", &steps[i - 1].mask, &steps[i - 1].duration_us) != 2)
+		{
+			help();
+			return -1;
+		}
+	}
+	fd = open("/dev/tl-led", O_RDWR);
+	if (fd < 0)
+	{
+		perror("Failed to open device");
+		return errno;
+	}
+	if (argc > 0)
+	{
+		pattern.repeat = strtoul(argv[0], NULL, 0);
+		pattern.len = argc - 1;
+		pattern.steps = (uintptr_t)steps;
+		ret = ioctl(fd, TLLED_IOC_PLAY, &pattern);
+	}
+	else
+	{
+		ret = ioctl(fd, TLLED_IOC_STOP);
+	}
+	if (ret < 0)
+	{
+		perror("Error playing the pattern");
+		close(fd);
+		return errno;
+	}
+	close(fd);
+	return 0;
 }
 
 int main(int argc, char* argv[])
@@ -31,74 +149,65 @@ int main(int argc, char* argv[])
 		close(fd);
 		return 0;
 	}
+	if (!strcmp(argv[1], "-p") && argc > 3)
+	{
+		return play_pattern(argc - 2, argv + 2);
+	}
+	if (!strcmp(argv[1], "-s"))
+	{
+		return play_pattern(0, NULL);
+	}
+	if (!strcmp(argv[1], "-r"))
+	{
+		return show_state();
+	}
+	if (!strcmp(argv[1], "-b") && argc == 4)
+	{
+		return set_brightness(argv[2], argv[3]);
+	}
 
-	char *arg1 = malloc(strlen(argv[1]));
-	if (arg1)
+	// Every LEDNR:STATE argument becomes a <led>:<state> pair of a single write
+	char *msg = malloc(6 * (argc - 1) + 1);
+	int i, n = 0;
+	if (msg)
 	{
-		if (strlen(argv[1]) != 3)
-		{
-			help();
-			free(arg1);
-			return -1;
-		}
-		else
+		for (i = 1; i < argc; ++i)
 		{
-			if (argv[1][1] == ':')
-			{
-				char lednr = argv[1][0];
-				char state = argv[1][2];
-
-				if ('0' > lednr || lednr > '2')
-				{
-					help();
-					free(arg1);
-					return -1;
-				}
-
-				if ('0' > state || state > '1')
-				{
-					help();
-					free(arg1);
-					return -1;
-				}
+			unsigned int lednr, state;
+			char end;
 
-				char msg[3];
-				msg[0] = lednr;
-				msg[1] = state;
-				msg[2] = 0;
-
-				//Now open file
-				printf("Now opening /dev/tl-led, sending STATE=%c to LED=%c ...\n", lednr, state);
-				int fd, ret;
-				fd = open("/dev/tl-led", O_RDWR);
-				if (fd < 0)
-				{
-					perror("Failed to open device");
-					free(arg1);
-					return errno;
-				}
-
-				ret = write(fd, msg, strlen(msg));
-
-				if (ret < 0)
-				{
-					perror("Error writing to device");
-					free(arg1);
-					close(fd);
-					return errno;
-				}
-				close(fd);
-				free(arg1);
-
-			}
-			else
+			if (sscanf(argv[i], "%u:%u%c", &lednr, &state, &end) != 2 ||
+					lednr >= TLLED_MAX_LEDS || state > 1)
 			{
 				help();
-				free(arg1);
+				free(msg);
 				return -1;
 			}
+			n += sprintf(msg + n, "%u:%u ", lednr, state);
+		}
+		msg[n] = 0;
+
+		//Now open file
+		printf("Now opening /dev/tl-led, sending batch \"%s\" ...\n", msg);
+		int fd, ret;
+		fd = open("/dev/tl-led", O_RDWR);
+		if (fd < 0)
+		{
+			perror("Failed to open device");
+			free(msg);
+			return errno;
 		}
+		ret = write(fd, msg, strlen(msg));
 
+		if (ret < 0)
+		{
+			perror("Error writing to device");
+			free(msg);
+			close(fd);
+			return errno;
+		}
+		close(fd);
+		free(msg);
 	}
 	return 0;
 }
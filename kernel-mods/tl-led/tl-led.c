@@ -2,7 +2,11 @@
  * @file   tl-led.c
  * @author Santiago Pagola 
  * @date   21/06/2017
- * @brief  A kernel module for controlling a trio of LEDs (traffic light)
+ * @brief  A kernel module for controlling a row of LEDs, by default a trio (traffic light)
+ *
+ * The LEDs are given as GPIO numbers in the gpios module parameter, e.g.
+ *   insmod tl-led.ko gpios=66,69,45,47,46
+ * LED n is the n-th GPIO, up to TLLED_MAX_LEDS of them.
  */
 
 #include <linux/init.h>
@@ -10,78 +14,294 @@
 #include <linux/device.h>
 #include <linux/kernel.h>
 #include <linux/fs.h>
-#include <linux/delay.h>
 #include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/ctype.h>
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <asm/io.h>
 #include <asm/uaccess.h>
 
+#include "tl-led.h"
+
+#define CREATE_TRACE_POINTS
+#include "tlled_trace.h"
+
 #define DEVICE_NAME "tl-led"
 #define CLASS_NAME "tl-led-drv"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Santiago Pagola");
-MODULE_DESCRIPTION("A kernel module for controlling a trio of LEDs (traffic light)");
+MODULE_DESCRIPTION("A kernel module for controlling a row of LEDs (traffic light)");
 MODULE_VERSION("0.1");
 
 static int major_number; //major number to be allocated to the character device
 
-/** To be on the safe side, let's allocate 4 bytes for this message,
- *  byte 0: holds the future led state
- *  byte 1: holds the LED ID
- *  byte 2: (might) hold an additional newline character that follows
- *  	    if /dev/tl-led is accessed via a shell (e.g. echo 1 > /dev/tl-led),
- *	    this could of course be ommited if the -n flag was given to echo,
- *	    but it doesn't hurt to include the possibility for people like me
- *	    who like to type as less as possible :-)
- *  byte 3: zero-termination
+#define TLLED_WRITE_CHUNK (64) // Bytes of a write copied and parsed at a time
+#define TLLED_WRITE_MAX   (4096) // Longest write, far more than a command per LED
+
+/** Command parser states, see batch_parse */
+enum tlled_parse_state
+{
+	TLLED_PARSE_IDLE,  // Between commands
+	TLLED_PARSE_PAIR,  // Got the first digit of a pair
+	TLLED_PARSE_PAIR2, // Got two digits, <led><state> unless a ':' follows
+	TLLED_PARSE_STATE, // Got <led>:
+	TLLED_PARSE_MASK,  // In the hex digits of m<mask>
+	TLLED_PARSE_A,     // Got "a"
+	TLLED_PARSE_AL,    // Got "al"
+	TLLED_PARSE_ALL,   // Got "all"
+	TLLED_PARSE_INVALID,
+};
+
+/** The commands of one write, on the writer's stack, applied once all of them
+ *  have been parsed. A write of "01", "01\n" (e.g. echo 01 > /dev/tl-led) or
+ *  "all" is a batch of a single command, see batch_parse for the rest.
  */
-static char message[4] = {0};
+struct tlled_batch
+{
+	unsigned int mask;    // LEDs changed by the batch
+	unsigned int values;  // Their new states
+	enum tlled_parse_state state;
+	unsigned int led;     // LED of a pending pair, or its two digits in TLLED_PARSE_PAIR2
+	unsigned int pending; // Mask being parsed
+	unsigned int digits;  // Hex digits of the mask so far
+	bool animate;         // "all" was given
+};
 
 static struct class* tlledClass = NULL;
 static struct device* tlledDev = NULL;
 
-static unsigned int gpio_led0 = 66; // Red LED ,on P8_7
-static unsigned int gpio_led1 = 69; // Yellow LED, on P8_9
-static unsigned int gpio_led2 = 45; // Green LED, on P8_11
+// Red LED on P8_7, yellow LED on P8_9, green LED on P8_11
+static unsigned int gpios[TLLED_MAX_LEDS] = { 66, 69, 45 };
+static unsigned int num_leds = 3;
+module_param_array(gpios, uint, &num_leds, S_IRUGO);
+MODULE_PARM_DESC(gpios, " GPIO numbers of the LEDs, LED n first, up to 32 of them (default=66,69,45)");
+
+#define TLLED_ALL GENMASK(num_leds - 1, 0)
 
-static bool ledOn_0 = 0; // Red led state
-static bool ledOn_1 = 0; // Yellow led state
-static bool ledOn_2 = 0; // Green led state
+/** The LEDs sorted by GPIO number, so that the LEDs of each GPIO bank are next to
+ *  each other and gpiolib updates every bank with a single register write.
+ *  led_descs[i] is LED led_order[i], e.g. 45 (GPIO1) then 66 and 69 (GPIO2) for
+ *  the default LEDs 2, 0 and 1. */
+static struct gpio_desc *led_descs[TLLED_MAX_LEDS];
+static unsigned int led_order[TLLED_MAX_LEDS];
+static unsigned int led_state = 0; // Bit n is set while LED n is on
+static struct tlled_status *status; // Page mapped read-only by dev_mmap, mirrors led_state
+static DEFINE_SPINLOCK(led_lock); // Protects led_state, the PWM schedule and orders the GPIO updates, also taken by the timers
+
+/** Software PWM. Every period starts with all lit LEDs on and each dimmed LED is
+ *  switched off after its on-time, rounded to TLLED_PWM_TICK_US. LEDs switching off
+ *  on the same tick share one edge, and so one GPIO update. pwm_timer only runs
+ *  while an LED is dimmed. The LEDs actually on are led_state & pwm_on.
+ */
+#define TLLED_PWM_TICK_US (100)
+#define TLLED_PWM_TICKS   (64) // Ticks per period, 6.4ms or 156Hz
+static unsigned int led_level[TLLED_MAX_LEDS] = { [0 ... TLLED_MAX_LEDS - 1] = TLLED_MAX_BRIGHTNESS };
+static struct hrtimer pwm_timer;
+static unsigned int pwm_lit = ~0U; // LEDs with a brightness, on at the start of a period
+static unsigned int pwm_on = ~0U;  // LEDs in the on phase of their period
+static struct
+{
+	unsigned int tick; // Ticks into the period
+	unsigned int mask; // LEDs switched off
+} pwm_edges[TLLED_MAX_LEDS]; // Sorted by tick
+static unsigned int pwm_nedges; // Number of edges in pwm_edges
+static unsigned int pwm_next;   // Edge pwm_timer handles next, pwm_nedges for the start of a period
+static DEFINE_MUTEX(pwm_mutex); // Serializes brightness changes
+
+/** One step of an LED sequence: set the LEDs in mask to values, then wait */
+struct tlled_step
+{
+	unsigned int mask;
+	unsigned int values;
+	unsigned int duration_us;
+};
+
+/** Animation when loading this module or on "all": four chases, each lighting the
+ *  LEDs one after another and switching them off in reverse order, and a last
+ *  triple flash. Built by animation_build for num_leds LEDs. */
+#define TLLED_CHASES     (4)
+#define TLLED_CHASE_US   (450000) // Length of a chase
+#define TLLED_FLASHES    (3)
+#define TLLED_FLASH_US   (150000) // Length of both halves of a flash
+static struct tlled_step *animation_steps;
+static unsigned int animation_len;
+
+/** The sequence being played by seq_timer. Only changed with seq_mutex held and
+ *  the timer stopped. */
+static struct hrtimer seq_timer;
+static const struct tlled_step *seq_steps;
+static bool seq_owned;          // seq_steps was allocated for an uploaded pattern
+static unsigned int seq_len;    // Number of steps
+static unsigned int seq_pos;    // Step being shown
+static unsigned int seq_repeat; // Plays left, including the current one, 0 plays forever
+static DEFINE_MUTEX(seq_mutex); // Serializes starting and stopping sequences
 
 //File operations
 static int dev_open(struct inode *, struct file *);
 static int dev_release(struct inode *, struct file *);
+static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
 static ssize_t dev_write(struct file *, const char*, size_t, loff_t *);
+static long dev_ioctl(struct file *, unsigned int, unsigned long);
+static int dev_mmap(struct file *, struct vm_area_struct *);
+static int batch_parse(struct tlled_batch *, char);
+static int batch_pair(struct tlled_batch *, unsigned int, char);
+static void set_leds(unsigned int mask, unsigned int values);
+static void leds_write(void);
+
+//Software PWM
+static void pwm_schedule(void);
+static int  pwm_set_level(unsigned int led, unsigned int level);
+static enum hrtimer_restart pwm_timer_cb(struct hrtimer *);
 
 //Setup/release leds
-static void setup_leds(void);
+static int  setup_leds(void);
 static void release_leds(void);
+static int  attrs_build(void);
 
-//Tiny animation
+//Tiny animation, played by the sequencer
+static int  animation_build(void);
 static void animation(void);
+static void seq_start(const struct tlled_step *steps, unsigned int len, unsigned int repeat, bool owned);
+static void seq_stop(void);
+static void seq_cancel(void);
+static void seq_release(void);
+static int  pattern_play(const struct tlled_pattern __user *);
+static enum hrtimer_restart seq_timer_cb(struct hrtimer *);
 
 static struct file_operations fops = 
 {
+	.owner = THIS_MODULE,
 	.open = dev_open,
+	.read = dev_read,
 	.write = dev_write,
+	.unlocked_ioctl = dev_ioctl,
+	.mmap = dev_mmap,
 	.release = dev_release,
 };
 
+/** sysfs attribute of one LED, led<n> */
+struct tlled_attr
+{
+	struct device_attribute attr;
+	unsigned int led;
+	char name[8];
+};
+
+static struct tlled_attr *led_attrs; // One per LED
+static struct attribute **tlled_attrs; // Pointers to them and a NULL
+static struct attribute_group tlled_group;
+static const struct attribute_group *tlled_groups[] = { &tlled_group, NULL };
+
+/** @function led_show
+ *  @brief Shows the state of one LED in /sys/class/tl-led-drv/tl-led/led<n>
+ *  @param dev The tl-led device
+ *  @param attr The attribute, in a struct tlled_attr
+ *  @param buf The page to print "0\n" or "1\n" to
+ *  @return The number of bytes printed
+ */
+static ssize_t led_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	unsigned int led = container_of(attr, struct tlled_attr, attr)->led;
+
+	return sprintf(buf, "%d\n", !!(READ_ONCE(led_state) & BIT(led)));
+}
+
+/** @function led_store
+ *  @brief Switches one LED on or off, like writing "<n><state>" to /dev/tl-led
+ *  @param dev The tl-led device
+ *  @param attr The attribute, in a struct tlled_attr
+ *  @param buf The new state, 0 or 1
+ *  @param count The length of buf
+ *  @return count on success, -EINVAL otherwise
+ */
+static ssize_t led_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int led = container_of(attr, struct tlled_attr, attr)->led;
+	bool on;
+
+	if (strtobool(buf, &on))
+		return -EINVAL;
+	seq_cancel();
+	set_leds(BIT(led), on ? BIT(led) : 0);
+	return count;
+}
+
+/** @function attrs_build
+ *  @brief Creates the led<n> attributes of the num_leds LEDs in tlled_group
+ *  @return 0 on success, -ENOMEM otherwise
+ */
+static int attrs_build(void)
+{
+	unsigned int i;
+
+	led_attrs = kcalloc(num_leds, sizeof(*led_attrs), GFP_KERNEL);
+	tlled_attrs = kcalloc(num_leds + 1, sizeof(*tlled_attrs), GFP_KERNEL);
+	if (!led_attrs || !tlled_attrs)
+	{
+		kfree(led_attrs);
+		kfree(tlled_attrs);
+		return -ENOMEM;
+	}
+	for (i = 0; i < num_leds; ++i)
+	{
+		snprintf(led_attrs[i].name, sizeof(led_attrs[i].name), "led%u", i);
+		sysfs_attr_init(&led_attrs[i].attr.attr);
+		led_attrs[i].attr.attr.name = led_attrs[i].name;
+		led_attrs[i].attr.attr.mode = 0644;
+		led_attrs[i].attr.show = led_show;
+		led_attrs[i].attr.store = led_store;
+		led_attrs[i].led = i;
+		tlled_attrs[i] = &led_attrs[i].attr.attr;
+	}
+	tlled_group.attrs = tlled_attrs;
+	return 0;
+}
+
 /** @function setup
  *  @brief This function will export our desired LEDS so we are able to access them
  *  All of them will be set as output pins
+ *  @return 0 on success, the error of gpio_request otherwise, e.g. -EBUSY for a GPIO
+ *  given twice
  */
-static void setup_leds(void)
+static int setup_leds(void)
 {
+	unsigned int i, j, led;
+	int err;
+
 	//LEDS
-	gpio_request(gpio_led0, "sysfs");
-	gpio_direction_output(gpio_led0, ledOn_0);
-	gpio_export(gpio_led0, false);
-	gpio_request(gpio_led1, "sysfs");
-	gpio_direction_output(gpio_led1, ledOn_1);
-	gpio_export(gpio_led1, false);
-	gpio_request(gpio_led2, "sysfs");
-	gpio_direction_output(gpio_led2, ledOn_2);
-	gpio_export(gpio_led2, false);
+	for (led = 0; led < num_leds; ++led)
+	{
+		err = gpio_request(gpios[led], "sysfs");
+		if (err)
+		{
+			printk(KERN_ALERT "TL-LED: failed to request GPIO %u for LED %u\n", gpios[led], led);
+			while (led--)
+			{
+				gpio_unexport(gpios[led]);
+				gpio_free(gpios[led]);
+			}
+			return err;
+		}
+		gpio_direction_output(gpios[led], led_state & BIT(led));
+		gpio_export(gpios[led], false);
+	}
+	//Descriptors for the array updates, by GPIO number and so grouped by bank
+	for (led = 0; led < num_leds; ++led)
+	{
+		for (i = led; i > 0 && gpios[led_order[i - 1]] > gpios[led]; --i)
+			led_order[i] = led_order[i - 1];
+		led_order[i] = led;
+	}
+	for (j = 0; j < num_leds; ++j)
+		led_descs[j] = gpio_to_desc(gpios[led_order[j]]);
+	return 0;
 }
 
 /** @function release_leds
@@ -89,69 +309,174 @@ static void setup_leds(void)
  */
 static void release_leds(void)
 {
+	unsigned int led;
+
 	//Turn off leds first
-	gpio_set_value(gpio_led0, 0);
-	gpio_set_value(gpio_led1, 0);
-	gpio_set_value(gpio_led2, 0);
-	//Unexport them
-	gpio_unexport(gpio_led0);
-	gpio_unexport(gpio_led1);
-	gpio_unexport(gpio_led2);
-	//And free them
-	gpio_free(gpio_led0);
-	gpio_free(gpio_led1);
-	gpio_free(gpio_led2);
+	set_leds(TLLED_ALL, 0);
+	//Unexport and free them
+	for (led = 0; led < num_leds; ++led)
+	{
+		gpio_unexport(gpios[led]);
+		gpio_free(gpios[led]);
+	}
 }
 
-/** @function animation
- *  @brief Animation when initalizing/removing this module
+/** @function seq_release
+ *  @brief Frees the steps of the last sequence if they were uploaded. Called with
+ *  seq_mutex held and seq_timer stopped.
  */
+static void seq_release(void)
+{
+	if (seq_owned)
+		kfree(seq_steps);
+	seq_steps = NULL;
+	seq_owned = false;
+}
 
-static void animation(void)
+/** @function seq_start
+ *  @brief Plays a sequence of LED steps from seq_timer, replacing the one being
+ *  played if any. Returns right after showing the first step.
+ *  @param steps The steps, must stay valid until the sequence ends or is stopped
+ *  @param len The number of steps
+ *  @param repeat How many times to play the steps, 0 for forever
+ *  @param owned Whether steps was kmalloc()ed for this sequence and is to be freed with it
+ */
+static void seq_start(const struct tlled_step *steps, unsigned int len, unsigned int repeat, bool owned)
 {
-	unsigned int i;
-	for (i=0; i<4; ++i)
+	mutex_lock(&seq_mutex);
+	hrtimer_cancel(&seq_timer);
+	seq_release();
+	seq_steps = steps;
+	seq_owned = owned;
+	seq_len = len;
+	seq_pos = 0;
+	seq_repeat = repeat;
+	set_leds(steps[0].mask, steps[0].values);
+	hrtimer_start(&seq_timer, ns_to_ktime((u64)steps[0].duration_us * NSEC_PER_USEC), HRTIMER_MODE_REL);
+	mutex_unlock(&seq_mutex);
+}
+
+/** @function seq_cancel
+ *  @brief Stops the sequence being played before LEDs are set by hand. Writers only
+ *  take seq_mutex while a sequence is actually playing, otherwise they only meet on
+ *  led_lock. A sequence started at the same time may still show its first step
+ *  over the new states, as if it had started right after them.
+ */
+static void seq_cancel(void)
+{
+	if (hrtimer_active(&seq_timer))
+		seq_stop();
+}
+
+/** @function seq_stop
+ *  @brief Stops the sequence being played, the LEDs keep their current state
+ */
+static void seq_stop(void)
+{
+	mutex_lock(&seq_mutex);
+	hrtimer_cancel(&seq_timer);
+	seq_release();
+	mutex_unlock(&seq_mutex);
+}
+
+/** @function seq_timer_cb
+ *  @brief Ends the current step of the sequence and shows the next one
+ *  @param timer The hrtimer that expired (seq_timer)
+ *  @return HRTIMER_RESTART while there are steps left, HRTIMER_NORESTART otherwise
+ */
+static enum hrtimer_restart seq_timer_cb(struct hrtimer *timer)
+{
+	const struct tlled_step *step;
+
+	if (++seq_pos == seq_len)
+	{
+		if (seq_repeat && --seq_repeat == 0)
+			return HRTIMER_NORESTART; // The LEDs stay as the last step left them
+		seq_pos = 0;
+	}
+	step = &seq_steps[seq_pos];
+	set_leds(step->mask, step->values);
+	// Relative to the previous expiry, so that steps do not drift
+	hrtimer_forward_now(timer, ns_to_ktime((u64)step->duration_us * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+/** @function animation_build
+ *  @brief Builds animation_steps for num_leds LEDs, see their declaration
+ *  @return 0 on success, -ENOMEM otherwise
+ */
+static int animation_build(void)
+{
+	unsigned int chase_us = max_t(unsigned int, TLLED_CHASE_US / (2 * num_leds), TLLED_MIN_STEP_US);
+	unsigned int i, led, n = 0;
+
+	animation_len = TLLED_CHASES * 2 * num_leds + TLLED_FLASHES * 2;
+	animation_steps = kmalloc_array(animation_len, sizeof(*animation_steps), GFP_KERNEL);
+	if (!animation_steps)
+		return -ENOMEM;
+	for (i = 0; i < TLLED_CHASES; ++i)
+	{
+		for (led = 0; led < num_leds; ++led)
+			animation_steps[n++] = (struct tlled_step){ BIT(led), BIT(led), chase_us };
+		for (led = num_leds; led-- > 0; )
+			animation_steps[n++] = (struct tlled_step){ BIT(led), 0, chase_us };
+	}
+	for (i = 0; i < TLLED_FLASHES; ++i)
 	{
-		ledOn_0 = true;
-		ledOn_1 = true;
-		ledOn_2 = true;
-		gpio_set_value(gpio_led0, ledOn_0);
-		msleep(75);
-		gpio_set_value(gpio_led1, ledOn_1);
-		msleep(75);
-		gpio_set_value(gpio_led2, ledOn_2);
-		msleep(75);
-		//Invert state
-		ledOn_0 = false;
-		ledOn_1 = false;
-		ledOn_2 = false;
-		gpio_set_value(gpio_led2, ledOn_2);
-		msleep(75);
-		gpio_set_value(gpio_led1, ledOn_1);
-		msleep(75);
-		gpio_set_value(gpio_led0, ledOn_0);
-		msleep(75);
+		animation_steps[n++] = (struct tlled_step){ TLLED_ALL, TLLED_ALL, TLLED_FLASH_US };
+		animation_steps[n++] = (struct tlled_step){ TLLED_ALL, 0, TLLED_FLASH_US };
 	}
-	
-	//Last triple flash
-	for (i=0; i<3; ++i)
+	return 0;
+}
+
+/** @function animation
+ *  @brief Animation when initalizing this module or on "all". It runs from a timer,
+ *  so this returns immediately.
+ */
+static void animation(void)
+{
+	seq_start(animation_steps, animation_len, 1, false);
+}
+
+/** @function pattern_play
+ *  @brief Copies a pattern from user space and starts playing it
+ *  @param upattern The pattern, see tl-led.h
+ *  @return 0 on success, -EFAULT, -EINVAL or -ENOMEM otherwise
+ */
+static int pattern_play(const struct tlled_pattern __user *upattern)
+{
+	struct tlled_pattern pattern;
+	struct tlled_pattern_step ustep;
+	const struct tlled_pattern_step __user *usteps;
+	struct tlled_step *steps;
+	unsigned int i;
+
+	if (copy_from_user(&pattern, upattern, sizeof(pattern)))
+		return -EFAULT;
+	if (!pattern.len || pattern.len > TLLED_MAX_STEPS)
+		return -EINVAL;
+	steps = kmalloc_array(pattern.len, sizeof(*steps), GFP_KERNEL);
+	if (!steps)
+		return -ENOMEM;
+	usteps = u64_to_user_ptr(pattern.steps);
+	for (i = 0; i < pattern.len; ++i)
 	{
-		ledOn_0 = true;
-		ledOn_1 = true;
-		ledOn_2 = true;
-		gpio_set_value(gpio_led0, ledOn_0);
-		gpio_set_value(gpio_led1, ledOn_1);
-		gpio_set_value(gpio_led2, ledOn_2);
-		msleep(150);
-		ledOn_0 = false;
-		ledOn_1 = false;
-		ledOn_2 = false;
-		gpio_set_value(gpio_led0, ledOn_0);
-		gpio_set_value(gpio_led1, ledOn_1);
-		gpio_set_value(gpio_led2, ledOn_2);
-		msleep(150);
-		
+		if (copy_from_user(&ustep, &usteps[i], sizeof(ustep)))
+		{
+			kfree(steps);
+			return -EFAULT;
+		}
+		if ((ustep.mask & ~TLLED_ALL) || ustep.duration_us < TLLED_MIN_STEP_US)
+		{
+			kfree(steps);
+			return -EINVAL;
+		}
+		steps[i].mask = TLLED_ALL;
+		steps[i].values = ustep.mask;
+		steps[i].duration_us = ustep.duration_us;
 	}
+	seq_start(steps, pattern.len, pattern.repeat, true);
+	return 0;
 }
 
 /** @function tlled_init
@@ -162,25 +487,47 @@ static void animation(void)
 static int __init tlled_init(void)
 {
 	int result = 0;
-	printk(KERN_INFO "TL-LED: Initializing module\n");
-	if (!gpio_is_valid(gpio_led0)){
-		printk(KERN_INFO "TL-LED: invalid LED GPIO %d\n", gpio_led0);
-		return -ENODEV;
+	unsigned int led;
+	printk(KERN_INFO "TL-LED: Initializing module with %u LEDs\n", num_leds);
+	if (!num_leds)
+		return -EINVAL;
+	for (led = 0; led < num_leds; ++led)
+	{
+		if (!gpio_is_valid(gpios[led])){
+			printk(KERN_INFO "TL-LED: invalid LED GPIO %d\n", gpios[led]);
+			return -ENODEV;
+		}
 	}
-	if (!gpio_is_valid(gpio_led1)){
-		printk(KERN_INFO "TL-LED: invalid LED GPIO %d\n", gpio_led1);
-		return -ENODEV;
+
+	//Animation and sysfs attributes for num_leds LEDs
+	result = animation_build();
+	if (result)
+		return result;
+	result = attrs_build();
+	if (result)
+	{
+		kfree(animation_steps);
+		return result;
 	}
-	if (!gpio_is_valid(gpio_led2)){
-		printk(KERN_INFO "TL-LED: invalid LED GPIO %d\n", gpio_led2);
-		return -ENODEV;
+
+	//Status page, before anything can change led_state
+	status = (struct tlled_status *)get_zeroed_page(GFP_KERNEL);
+	if (!status)
+	{
+		result = -ENOMEM;
+		goto out_attrs;
 	}
+	status->version = TLLED_STATUS_VERSION;
+	status->num_leds = num_leds;
 
 	//Setup the leds
-	setup_leds();
-
-	//Initial animation
-	animation();
+	hrtimer_init(&seq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	seq_timer.function = seq_timer_cb;
+	hrtimer_init(&pwm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	pwm_timer.function = pwm_timer_cb;
+	result = setup_leds();
+	if (result)
+		goto out_status;
 
 	//Now register character device
 	//Register major number
@@ -188,7 +535,8 @@ static int __init tlled_init(void)
 	if (major_number<0)
 	{
 		printk(KERN_ALERT "TL-LED failed to register major number\n");
-		return major_number;
+		result = major_number;
+		goto out_leds;
 	}
 	printk(KERN_INFO "TL-LED: registered major number %d\n", major_number);
 
@@ -196,22 +544,38 @@ static int __init tlled_init(void)
 	tlledClass = class_create(THIS_MODULE, CLASS_NAME);
 	if (IS_ERR(tlledClass))
 	{
-		unregister_chrdev(major_number, DEVICE_NAME);
 		printk(KERN_ALERT "Failed to register device class\n");
-		return PTR_ERR(tlledClass);
+		result = PTR_ERR(tlledClass);
+		goto out_chrdev;
 	}
 	printk(KERN_INFO "TL-LED: device class successfully registered\n");
 
 	//Register device driver
-	tlledDev = device_create(tlledClass, NULL, MKDEV(major_number,0), NULL, DEVICE_NAME);
+	tlledDev = device_create_with_groups(tlledClass, NULL, MKDEV(major_number,0), NULL, tlled_groups, DEVICE_NAME);
 	if (IS_ERR(tlledDev))
 	{
-		class_destroy(tlledClass);
-		unregister_chrdev(major_number, DEVICE_NAME);
 		printk(KERN_ALERT "Failed to create the device\n");
-		return PTR_ERR(tlledDev);
+		result = PTR_ERR(tlledDev);
+		goto out_class;
 	}
 	printk(KERN_INFO "TL-LED: device class created successfully\n");
+
+	//Initial animation, played in the background
+	animation();
+	return 0;
+
+out_class:
+	class_destroy(tlledClass);
+out_chrdev:
+	unregister_chrdev(major_number, DEVICE_NAME);
+out_leds:
+	release_leds();
+out_status:
+	free_page((unsigned long)status);
+out_attrs:
+	kfree(led_attrs);
+	kfree(tlled_attrs);
+	kfree(animation_steps);
 	return result;
 }
 
@@ -224,15 +588,20 @@ static int __init tlled_init(void)
  */
 static void __exit tlled_exit(void)
 {
-	//Show final animation
-	animation();
-	//Release leds
-	release_leds();
-	//unregister character device
+	//Stop any animation and the PWM
+	seq_stop();
+	hrtimer_cancel(&pwm_timer);
+	//unregister character device, and with it the led<n> attributes
 	device_destroy(tlledClass, MKDEV(major_number, 0));
 	class_unregister(tlledClass);
 	class_destroy(tlledClass);
 	unregister_chrdev(major_number, DEVICE_NAME);
+	//Release leds
+	release_leds();
+	free_page((unsigned long)status);
+	kfree(led_attrs);
+	kfree(tlled_attrs);
+	kfree(animation_steps);
 	printk(KERN_INFO "TL-LED: Exiting now\n");
 }
 
@@ -244,7 +613,7 @@ static void __exit tlled_exit(void)
  */
 static int dev_open(struct inode* inodep, struct file *filep)
 {
-	printk(KERN_INFO "TL-LED: Device opened\n");
+	trace_tlled_open(led_state);
 	return 0;
 }
 
@@ -256,94 +625,383 @@ static int dev_open(struct inode* inodep, struct file *filep)
  */
 static int dev_release(struct inode *inodep, struct file *filep)
 {
-	printk(KERN_INFO "TL-LED: Device closed\n");
+	trace_tlled_release(led_state);
+	return 0;
+}
+
+/** @function batch_pair
+ *  @brief Adds one <led><state> pair to a batch
+ *  @param batch The commands parsed so far
+ *  @param led The LED
+ *  @param c Its state, '0' or '1'
+ *  @return 0 on success, -EINVAL for an unknown LED or state
+ */
+static int batch_pair(struct tlled_batch *batch, unsigned int led, char c)
+{
+	if (led >= num_leds || (c != '0' && c != '1'))
+		return -EINVAL;
+	batch->mask |= BIT(led);
+	if (c == '1')
+		batch->values |= BIT(led);
+	else
+		batch->values &= ~BIT(led);
+	return 0;
+}
+
+/** @function batch_parse
+ *  @brief Feeds one character of a write to the command parser. Commands are
+ *  separated by whitespace, ',' or ';', or follow each other directly:
+ *  "<led><state>" sets one of LEDs 0 to 9, e.g. "11" turns on LED 1,
+ *  "<led>:<state>" sets any LED, e.g. "12:1" turns on LED 12,
+ *  "m<hex mask>" sets every LED, bit n for LED n, e.g. "m5" turns on LEDs 0 and 2,
+ *  "all" plays the animation.
+ *  A pair may follow another pair without a separator, as in "011020".
+ *  @param batch The commands parsed so far
+ *  @param c The next character, '\0' ends the last command
+ *  @return 0 on success, -EINVAL on an invalid command
+ */
+static int batch_parse(struct tlled_batch *batch, char c)
+{
+	bool sep = (c == '\0' || c == ',' || c == ';' || isspace(c));
+	int err;
+
+	switch (batch->state)
+	{
+		case TLLED_PARSE_IDLE:
+			if (sep)
+				return 0;
+			if (isdigit(c))
+			{
+				batch->led = c - '0';
+				batch->state = TLLED_PARSE_PAIR;
+			}
+			else if (c == 'm')
+			{
+				batch->pending = 0;
+				batch->digits = 0;
+				batch->state = TLLED_PARSE_MASK;
+			}
+			else if (c == 'a')
+			{
+				batch->state = TLLED_PARSE_A;
+			}
+			else
+			{
+				return -EINVAL;
+			}
+			return 0;
+		case TLLED_PARSE_PAIR:
+			if (c == ':')
+				batch->state = TLLED_PARSE_STATE;
+			else if (isdigit(c))
+			{
+				batch->led = batch->led * 10 + (c - '0');
+				batch->state = TLLED_PARSE_PAIR2;
+			}
+			else
+				return -EINVAL;
+			return 0;
+		case TLLED_PARSE_PAIR2:
+			if (c == ':')
+			{
+				batch->state = TLLED_PARSE_STATE; // Two digit LED
+				return 0;
+			}
+			// The two digits were a <led><state> pair, c starts the next command
+			err = batch_pair(batch, batch->led / 10, '0' + batch->led % 10);
+			if (err)
+				return err;
+			batch->state = TLLED_PARSE_IDLE;
+			return batch_parse(batch, c);
+		case TLLED_PARSE_STATE:
+			err = batch_pair(batch, batch->led, c);
+			batch->state = TLLED_PARSE_IDLE;
+			return err;
+		case TLLED_PARSE_MASK:
+			if (sep)
+			{
+				if (!batch->digits || (batch->pending & ~TLLED_ALL))
+					return -EINVAL;
+				batch->mask = TLLED_ALL;
+				batch->values = batch->pending;
+				batch->state = TLLED_PARSE_IDLE;
+				return 0;
+			}
+			if (hex_to_bin(c) < 0 || ++batch->digits > 8)
+				return -EINVAL;
+			batch->pending = (batch->pending << 4) | hex_to_bin(c);
+			return 0;
+		case TLLED_PARSE_A:
+			batch->state = (c == 'l') ? TLLED_PARSE_AL : TLLED_PARSE_INVALID;
+			break;
+		case TLLED_PARSE_AL:
+			batch->state = (c == 'l') ? TLLED_PARSE_ALL : TLLED_PARSE_INVALID;
+			break;
+		case TLLED_PARSE_ALL:
+			if (!sep)
+				return -EINVAL;
+			batch->animate = true;
+			batch->state = TLLED_PARSE_IDLE;
+			return 0;
+		default:
+			break;
+	}
+	return batch->state == TLLED_PARSE_INVALID ? -EINVAL : 0;
+}
+
+/** @function set_leds
+ *  @brief Changes the state of a set of LEDs in a single operation. The GPIO
+ *  controller writes each bank's DATAOUT register once for all of its LEDs, so
+ *  LEDs sharing a bank switch at the very same time and never show a mix of the
+ *  old and the new state.
+ *  @param mask The LEDs to change, bit n for LED n
+ *  @param values Their new states, in the same bits
+ */
+static void set_leds(unsigned int mask, unsigned int values)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&led_lock, flags);
+	led_state = (led_state & ~mask) | (values & mask);
+	leds_write();
+	WRITE_ONCE(status->leds, led_state);
+	smp_wmb(); // leds before changes, see tl-led.h
+	WRITE_ONCE(status->changes, status->changes + 1);
+	spin_unlock_irqrestore(&led_lock, flags);
+}
+
+/** @function leds_write
+ *  @brief Drives the LEDs that are on and in the on phase of their PWM period, all
+ *  of them in one GPIO array update. Called with led_lock held.
+ */
+static void leds_write(void)
+{
+	int value_array[TLLED_MAX_LEDS];
+	unsigned int i, out = led_state & pwm_on;
+
+	for (i = 0; i < num_leds; ++i)
+		value_array[i] = !!(out & BIT(led_order[i]));
+	gpiod_set_array_value(num_leds, led_descs, value_array);
+}
+
+/** @function pwm_schedule
+ *  @brief Turns the brightness levels into the edges of a PWM period. Called with
+ *  led_lock held.
+ */
+static void pwm_schedule(void)
+{
+	unsigned int led, ticks, i, j;
+
+	pwm_lit = 0;
+	pwm_nedges = 0;
+	for (led = 0; led < num_leds; ++led)
+	{
+		if (!led_level[led])
+			continue;
+		pwm_lit |= BIT(led);
+		ticks = DIV_ROUND_CLOSEST(led_level[led] * TLLED_PWM_TICKS, TLLED_MAX_BRIGHTNESS);
+		ticks = clamp_t(unsigned int, ticks, 1, TLLED_PWM_TICKS);
+		if (ticks == TLLED_PWM_TICKS)
+			continue; // Always on
+		// Insert in order, sharing the edge of LEDs switching off on the same tick
+		for (i = 0; i < pwm_nedges && pwm_edges[i].tick < ticks; ++i)
+			;
+		if (i < pwm_nedges && pwm_edges[i].tick == ticks)
+		{
+			pwm_edges[i].mask |= BIT(led);
+			continue;
+		}
+		for (j = pwm_nedges++; j > i; --j)
+			pwm_edges[j] = pwm_edges[j - 1];
+		pwm_edges[i].tick = ticks;
+		pwm_edges[i].mask = BIT(led);
+	}
+}
+
+/** @function pwm_set_level
+ *  @brief Changes the brightness of an LED and restarts the PWM periods
+ *  @param led The LED
+ *  @param level Its brightness, 0 to TLLED_MAX_BRIGHTNESS
+ *  @return 0 on success, -EINVAL otherwise
+ */
+static int pwm_set_level(unsigned int led, unsigned int level)
+{
+	unsigned long flags;
+
+	if (led >= num_leds || level > TLLED_MAX_BRIGHTNESS)
+		return -EINVAL;
+	mutex_lock(&pwm_mutex);
+	hrtimer_cancel(&pwm_timer);
+	spin_lock_irqsave(&led_lock, flags);
+	led_level[led] = level;
+	pwm_schedule();
+	pwm_on = pwm_lit;
+	pwm_next = 0;
+	leds_write();
+	spin_unlock_irqrestore(&led_lock, flags);
+	if (pwm_nedges)
+		hrtimer_start(&pwm_timer, ns_to_ktime((u64)pwm_edges[0].tick * TLLED_PWM_TICK_US * NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+	mutex_unlock(&pwm_mutex);
 	return 0;
 }
 
+/** @function pwm_timer_cb
+ *  @brief Handles the next edge of the PWM period: switches off every LED whose
+ *  on-time ends on this tick, or switches the lit LEDs back on at the start of a
+ *  period, with one GPIO update either way
+ *  @param timer The hrtimer that expired (pwm_timer)
+ *  @return HRTIMER_RESTART, the timer is only stopped by pwm_set_level
+ */
+static enum hrtimer_restart pwm_timer_cb(struct hrtimer *timer)
+{
+	unsigned int tick, next;
+
+	spin_lock(&led_lock);
+	if (pwm_next == pwm_nedges)
+	{
+		pwm_on = pwm_lit;
+		tick = 0;
+		pwm_next = 0;
+	}
+	else
+	{
+		pwm_on &= ~pwm_edges[pwm_next].mask;
+		tick = pwm_edges[pwm_next].tick;
+		pwm_next++;
+	}
+	leds_write();
+	next = (pwm_next < pwm_nedges) ? pwm_edges[pwm_next].tick : TLLED_PWM_TICKS;
+	spin_unlock(&led_lock);
+
+	hrtimer_forward_now(timer, ns_to_ktime((u64)(next - tick) * TLLED_PWM_TICK_US * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+/** @function dev_read
+ *  @brief Returns the state of every LED as the pairs a write takes, e.g. "01 11 20\n"
+ *  with LEDs 0 and 1 on and LED 2 off, and "<led>:<state>" from LED 10 on, so that it
+ *  can be written back to restore them. Reading never blocks, the file ends after the
+ *  line.
+ *  @param filep A pointer to the file structure, defined in fs.h
+ *  @param buffer The user-space buffer to copy the state to
+ *  @param len The length of the buffer
+ *  @param offset The position in the line
+ *  @return the number of bytes copied, 0 at the end of the line, -EFAULT otherwise
+ */
+static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *offset)
+{
+	char out[5 * TLLED_MAX_LEDS];
+	unsigned int leds = READ_ONCE(led_state);
+	unsigned int i, n = 0;
+
+	for (i = 0; i < num_leds; ++i)
+		n += sprintf(out + n, i < 10 ? "%u%d " : "%u:%d ", i, !!(leds & BIT(i)));
+	out[n - 1] = '\n';
+	return simple_read_from_buffer(buffer, len, offset, out, n);
+}
+
+/** @function dev_mmap
+ *  @brief Maps the status page read-only, see struct tlled_status in tl-led.h
+ *  @param filep A pointer to the file structure, defined in fs.h
+ *  @param vma The user mapping, a single page at offset 0
+ *  @return 0 on success, -EPERM for writable mappings, -EINVAL or -EAGAIN otherwise
+ */
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_pfn_range(vma, vma->vm_start, virt_to_phys(status) >> PAGE_SHIFT,
+			PAGE_SIZE, vma->vm_page_prot);
+}
+
 /** @function dev_write
- *  @brief Write function used to write data from user-space to this character device
- *  Note the use of copy_from_user function, since we need to copy the data coming from
- *  user-space (i.e. buffer) to our static array "message" in order to be able to use it
+ *  @brief Write function used to write data from user-space to this character device.
+ *  The buffer holds a batch of any number of commands (see batch_parse), copied and
+ *  parsed TLLED_WRITE_CHUNK bytes at a time. Nothing is changed unless all of them are
+ *  valid, and then all LEDs are updated at once, the last command for an LED wins.
+ *  Setting LEDs stops the sequence or pattern being played, if any.
+ *  The batch lives on the caller's stack and the LEDs are set under led_lock, so
+ *  concurrent writers never see each other's half-parsed commands.
  *  @param filep A pointer to the file structure, defined in fs.h
  *  @param buffer The data coming from user-space
- *  @param len Then length of the copied bytes from user-space
+ *  @param len Then length of the copied bytes from user-space, up to TLLED_WRITE_MAX
  *  @param offset An optional offset that may be given
- *  @return the number of bytes copied to the character device
+ *  @return the number of bytes copied to the character device, -EFAULT or -EINVAL otherwise
  */
 static ssize_t dev_write(struct file *filep, const char* buffer, size_t len, loff_t *offset)
 {
-	//Some data was written from user space
-	printk(KERN_INFO "Received buffer size: %d\n", len);
+	ktime_t start = trace_tlled_write_enabled() ? ktime_get() : 0;
+	struct tlled_batch batch = { 0 };
+	char chunk[TLLED_WRITE_CHUNK];
+	size_t done, n, i;
 	int err = 0;
-	err = copy_from_user(message, buffer, len);
-	message[len] = 0;
-	if (len == 2)
-	{
-		printk(KERN_INFO "Received buffer [%s], led status for led \"%c\" is: [%c]\n", message, message[1], message[0]);
-	}
-	else
+
+	//Some data was written from user space
+	if (len > TLLED_WRITE_MAX)
+		return -EINVAL;
+	for (done = 0; done < len && !err; done += n)
 	{
-		if (!strcmp(message, "all"))
-		{
-			printk(KERN_INFO "Will animate LEDs!\n");
-			animation();
-			return len;
-		}
-		else
-		{
-			printk(KERN_INFO "Invalid command received \"%s\", skipping...\n", message);
-			return len;
-		}
+		n = min_t(size_t, len - done, sizeof(chunk));
+		if (copy_from_user(chunk, buffer + done, n))
+			return -EFAULT;
+		for (i = 0; i < n && !err; ++i)
+			err = batch_parse(&batch, chunk[i]);
 	}
-	if (message[1] == '0')
+	if (!err)
+		err = batch_parse(&batch, '\0'); // End the last command
+	if (err || batch.state != TLLED_PARSE_IDLE)
 	{
-		if (message[0] == '0')
-		{
-			gpio_set_value(gpio_led0, false);
-			ledOn_0 = false;
-		}
-		else if (message[0] == '1')
-		{
-			gpio_set_value(gpio_led1, false);
-			ledOn_1 = false;
-		}
-		else if (message[0] == '2')
-		{
-			gpio_set_value(gpio_led2, false);
-			ledOn_2 = false;
-		}
-		else
-		{
-			printk(KERN_INFO "Unknown LED-ID received: %c\n", message[1]);
-		}
+		pr_debug("TL-LED: Invalid command received, skipping...\n");
+		return -EINVAL;
 	}
-	else if (message[1] == '1')
+
+	if (batch.mask)
 	{
-		if (message[0] == '0')
-		{
-			gpio_set_value(gpio_led0, true);
-			ledOn_0 = true;
-		}
-		else if (message[0] == '1')
-		{
-			gpio_set_value(gpio_led1, true);
-			ledOn_1 = true;
-		}
-		else if (message[0] == '2')
-		{
-			gpio_set_value(gpio_led2, true);
-			ledOn_2 = true;
-		}
-		else
-		{
-			printk(KERN_INFO "Unknown LED-ID received: %c\n", message[1]);
-		}
+		seq_cancel();
+		set_leds(batch.mask, batch.values);
 	}
-	else
+	if (batch.animate)
+		animation();
+	trace_tlled_write(len, batch.mask, READ_ONCE(led_state), start);
+	return len;
+}
+
+/** @function dev_ioctl
+ *  @brief Pattern playback and brightness, see tl-led.h
+ *  @param filep A pointer to the file structure, defined in fs.h
+ *  @param cmd TLLED_IOC_PLAY, TLLED_IOC_STOP, TLLED_IOC_SET_BRIGHTNESS or TLLED_IOC_GET_BRIGHTNESS
+ *  @param arg Pointer to a struct tlled_pattern or struct tlled_brightness in user space
+ *  @return 0 on success, -EFAULT, -EINVAL, -ENOMEM or -ENOTTY otherwise
+ */
+static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+	struct tlled_brightness brightness;
+
+	switch (cmd)
 	{
-		printk(KERN_INFO "Unknown stream received: %s\n", buffer);
+		case TLLED_IOC_PLAY:
+			return pattern_play((const struct tlled_pattern __user *)arg);
+		case TLLED_IOC_STOP:
+			seq_stop();
+			return 0;
+		case TLLED_IOC_SET_BRIGHTNESS:
+			if (copy_from_user(&brightness, (void __user *)arg, sizeof(brightness)))
+				return -EFAULT;
+			return pwm_set_level(brightness.led, brightness.level);
+		case TLLED_IOC_GET_BRIGHTNESS:
+			if (copy_from_user(&brightness, (void __user *)arg, sizeof(brightness)))
+				return -EFAULT;
+			if (brightness.led >= num_leds)
+				return -EINVAL;
+			brightness.level = READ_ONCE(led_level[brightness.led]);
+			return copy_to_user((void __user *)arg, &brightness, sizeof(brightness)) ? -EFAULT : 0;
+		default:
+			return -ENOTTY;
 	}
-	return len;
 }
 
 /// This next calls are  mandatory -- they identify the initialization function
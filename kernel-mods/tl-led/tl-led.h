@@ -0,0 +1,71 @@
+/**
+ * @file   tl-led.h
+ * @author Santiago Pagola
+ * @license GPL
+ * @brief  Definitions shared between the tl-led driver and user space.
+ *
+ * TLLED_IOC_PLAY uploads a pattern, a timeline of LED states, that the driver
+ * plays back from a high resolution timer: every step switches the LEDs to its
+ * mask (bit n for LED n) and holds them for duration_us microseconds. The
+ * whole timeline is played repeat times, or until TLLED_IOC_STOP, another
+ * pattern, an "all" or any LED command written to /dev/tl-led.
+ *
+ * TLLED_IOC_SET_BRIGHTNESS dims an LED with a software PWM of about 156Hz;
+ * the LED is still switched on and off as usual, at that brightness.
+ *
+ * The current state can be read back in three ways: read() returns it as the
+ * "<led><state>" or "<led>:<state>" pairs a write takes, /sys/class/tl-led-drv/tl-led/led<n>
+ * holds 0 or 1 per LED, and mmap() of one page at offset 0 gives a read-only
+ * struct tlled_status kept up to date by the driver. To check whether the
+ * LEDs changed between two looks at the page, compare changes: the driver
+ * updates leds before it increments changes.
+ */
+
+#ifndef _TLLED_H_
+#define _TLLED_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define TLLED_MAX_LEDS    (32)  /*!< most LEDs a device drives, bit n of a mask is LED n */
+#define TLLED_MAX_STEPS   (256) /*!< longest pattern */
+#define TLLED_MIN_STEP_US (50)  /*!< shortest step */
+#define TLLED_MAX_BRIGHTNESS (255) /*!< fully on, the default */
+
+/** One step of a pattern */
+struct tlled_pattern_step {
+	__u32 mask;        /*!< LEDs on during the step, bit n for LED n */
+	__u32 duration_us; /*!< how long the step lasts */
+};
+
+/** A pattern to play */
+struct tlled_pattern {
+	__u32 repeat; /*!< times to play the steps, 0 plays them until stopped */
+	__u32 len;    /*!< number of steps, 1 to TLLED_MAX_STEPS */
+	__u64 steps;  /*!< user pointer to len struct tlled_pattern_step */
+};
+
+/** Brightness of an LED */
+struct tlled_brightness {
+	__u32 led;   /*!< LED number */
+	__u32 level; /*!< 0 (always off) to TLLED_MAX_BRIGHTNESS */
+};
+
+#define TLLED_STATUS_VERSION (1)
+
+/** Status page, at offset 0 of the mapping */
+struct tlled_status {
+	__u32 version;  /*!< TLLED_STATUS_VERSION */
+	__u32 num_leds; /*!< number of LEDs */
+	__u32 leds;     /*!< LEDs switched on, bit n for LED n */
+	__u32 changes;  /*!< LED updates so far */
+};
+
+/* ioctl commands */
+#define TLLED_IOC_MAGIC 'l'
+#define TLLED_IOC_PLAY  _IOW(TLLED_IOC_MAGIC, 1, struct tlled_pattern)
+#define TLLED_IOC_STOP  _IO(TLLED_IOC_MAGIC, 2)
+#define TLLED_IOC_SET_BRIGHTNESS _IOW(TLLED_IOC_MAGIC, 3, struct tlled_brightness)
+#define TLLED_IOC_GET_BRIGHTNESS _IOWR(TLLED_IOC_MAGIC, 4, struct tlled_brightness)
+
+#endif /* _TLLED_H_ */
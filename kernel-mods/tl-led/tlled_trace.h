@@ -0,0 +1,73 @@
+/**
+ * @file   tlled_trace.h
+ * @author Santiago Pagola
+ * @license GPL
+ * @brief  Tracepoints of the tl-led driver, in the tl_led trace system.
+ *
+ * Enable them with e.g.
+ *   echo 1 > /sys/kernel/debug/tracing/events/tl_led/enable
+ * or record them with perf record -e 'tl_led:*'. They cost a patched-out
+ * branch while disabled.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tl_led
+
+#if !defined(_TLLED_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _TLLED_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+DECLARE_EVENT_CLASS(tlled_file,
+	TP_PROTO(unsigned int leds),
+	TP_ARGS(leds),
+	TP_STRUCT__entry(
+		__field(unsigned int, leds)
+	),
+	TP_fast_assign(
+		__entry->leds = leds;
+	),
+	TP_printk("leds=0x%x", __entry->leds)
+);
+
+/** /dev/tl-led opened, with the LED mask at that time */
+DEFINE_EVENT(tlled_file, tlled_open,
+	TP_PROTO(unsigned int leds),
+	TP_ARGS(leds)
+);
+
+/** /dev/tl-led closed, with the LED mask at that time */
+DEFINE_EVENT(tlled_file, tlled_release,
+	TP_PROTO(unsigned int leds),
+	TP_ARGS(leds)
+);
+
+/** A batch of commands was applied: the LEDs it changed, the resulting LED
+ *  mask (bit n for LED n) and how long it took since start */
+TRACE_EVENT(tlled_write,
+	TP_PROTO(size_t len, unsigned int changed, unsigned int leds, ktime_t start),
+	TP_ARGS(len, changed, leds, start),
+	TP_STRUCT__entry(
+		__field(size_t, len)
+		__field(unsigned int, changed)
+		__field(unsigned int, leds)
+		__field(s64, latency_ns)
+	),
+	TP_fast_assign(
+		__entry->len = len;
+		__entry->changed = changed;
+		__entry->leds = leds;
+		__entry->latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	),
+	TP_printk("len=%zu changed=0x%x leds=0x%x latency_ns=%lld",
+		__entry->len, __entry->changed, __entry->leds, __entry->latency_ns)
+);
+
+#endif /* _TLLED_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tlled_trace
+#include <trace/define_trace.h>
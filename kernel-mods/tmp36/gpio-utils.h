@@ -23,9 +23,19 @@
 #define HIGH (1)
 #define LOW  (0) 
 
+/* ADC_TSC registers not covered by am335x.h */
+#define ADC_FIFO0COUNT       (ADC_TSC+0xE4)
+#define ADC_FIFO_COUNT_MASK  (0x7F)
+#define ADC_CTRL_STEP_ID_TAG (0x01<<1)
+#define ADC_NUM_AIN          (8)
+#define ADC_SCAN_TIMEOUT     (100000)
+
+#define GPIO_NUM_BANKS       (4)
+
 
 static volatile uint32_t *map;
 static char mapped = FALSE;
+static uint32_t gpio_outputs[GPIO_NUM_BANKS]; // pins already switched to output by gpioOutput, per bank
 
 /**
  * map /dev/mem to memory
@@ -85,16 +95,54 @@ int pinMode(PIN pin, unsigned char direction, unsigned char mux, unsigned char p
 
 
 /**
- * Set a GPIO digital output * @param p Pin to write to
+ * Index of a GPIO bank, for gpio_outputs
+ *
+ * @param bank Base address of the bank, GPIO0 to GPIO3
+ * @returns 0 to 3
+ */
+static int gpioBankIndex(unsigned int bank) {
+	switch(bank) {
+		case GPIO0: return 0;
+		case GPIO1: return 1;
+		case GPIO2: return 2;
+		default:    return 3;
+	}
+}
+
+/**
+ * Switch a GPIO to output, once: the read-modify-write of GPIO_OE is only done
+ * the first time for each pin, later calls only check gpio_outputs. Changes
+ * made to GPIO_OE by anything else (e.g. the kernel) are not noticed.
+ *
+ * @param p Pin to switch to output
+ * @returns 1
+ */
+int gpioOutput(PIN p) {
+	uint32_t bit = 1u << p.bank_id;
+	uint32_t *outputs = &gpio_outputs[gpioBankIndex(p.gpio_bank)];
+
+	if(__atomic_load_n(outputs, __ATOMIC_RELAXED) & bit) return 1;
+	init();
+	map[(p.gpio_bank-MMAP_OFFSET+GPIO_OE)/4] &= ~bit;
+	__atomic_fetch_or(outputs, bit, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/**
+ * Set a GPIO digital output. The pin is switched to output on the first call,
+ * after that every call is a single store to GPIO_SETDATAOUT or GPIO_CLEARDATAOUT,
+ * which only change the pin given, so threads writing other pins of the same bank
+ * cannot undo each other's writes as with a read-modify-write of GPIO_DATAOUT.
+ * Call gpioOutput for every pin before starting such threads, as the first
+ * GPIO_OE update is still a read-modify-write.
  *
+ * @param p Pin to write to
  * @param mode Position to set the pin, HIGH or LOW
  * @returns output was successfully written
  */
 int digitalWrite(PIN p, uint8_t mode) {
-	init();
-	map[(p.gpio_bank-MMAP_OFFSET+GPIO_OE)/4] &= ~(1<<p.bank_id);
-	if(mode == HIGH) map[(p.gpio_bank-MMAP_OFFSET+GPIO_DATAOUT)/4] |= 1<<p.bank_id;
-	else map[(p.gpio_bank-MMAP_OFFSET+GPIO_DATAOUT)/4] &= ~(1<<p.bank_id);
+	gpioOutput(p);
+	map[(p.gpio_bank-MMAP_OFFSET+(mode == HIGH ? GPIO_SETDATAOUT : GPIO_CLEARDATAOUT))/4] = 1u << p.bank_id;
 
 	return 1;
 }
@@ -172,5 +220,50 @@ int analogRead(PIN p) {
 	return map[(ADC_FIFO0DATA-MMAP_OFFSET)/4] & ADC_FIFO_MASK;
 }
 
+/**
+ * Read in from several analog pins in one pass of the step sequencer,
+ * instead of one analogRead per pin
+ *
+ * @param mask the analog inputs to read, bit n for AINn
+ * @param values where to store the analog values, indexed by AIN, at least 8 entries
+ * @returns the number of values read, or -1 if the ADC did not answer
+ */
+int analogScan(uint8_t mask, int *values) {
+	unsigned int pending = mask, timeout = ADC_SCAN_TIMEOUT, ain, n = 0;
+	uint32_t word;
+
+	init();
+
+	// the clock module is not enabled
+	if(map[(CM_WKUP_ADC_TSC_CLKCTRL-MMAP_OFFSET)/4] & CM_WKUP_IDLEST_DISABLED)
+		adc_init();
+
+	// tag every FIFO word with the step, i.e. the pin, it belongs to
+	map[(ADC_CTRL-MMAP_OFFSET)/4] |= ADC_CTRL_STEP_ID_TAG;
+
+	// throw away whatever is left in FIFO0
+	while(map[(ADC_FIFO0COUNT-MMAP_OFFSET)/4] & ADC_FIFO_COUNT_MASK)
+		word = map[(ADC_FIFO0DATA-MMAP_OFFSET)/4];
+
+	// enable the step sequencer for all the pins at once
+	map[(ADC_STEPENABLE-MMAP_OFFSET)/4] |= ((uint32_t)mask)<<1;
+
+	while(pending) {
+		if(!(map[(ADC_FIFO0COUNT-MMAP_OFFSET)/4] & ADC_FIFO_COUNT_MASK)) {
+			if(!--timeout)
+				return -1;
+			continue;
+		}
+		word = map[(ADC_FIFO0DATA-MMAP_OFFSET)/4];
+		ain = (word>>16) & 0x0F;
+		if(ain < ADC_NUM_AIN && (pending & (1<<ain))) {
+			values[ain] = word & ADC_FIFO_MASK;
+			pending &= ~(1<<ain);
+			n++;
+		}
+	}
+	return n;
+}
+
 
 #endif /* _GPIO_UTILS_H_*/
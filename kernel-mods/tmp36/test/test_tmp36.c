@@ -2,7 +2,14 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+#include "../tmp36.h"
 
 int fd; // file descriptor
 
@@ -17,10 +24,169 @@ void sig_handler(int signo)
 	}
 }
 
+/* Consume the samples straight from the mmap()ed ring, no syscall per batch */
+int read_mmap()
+{
+	struct tmp36_ring *ring;
+	struct tmp36_sample *data;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	size_t size;
+	__u32 head, tail, lost = 0;
+
+	// Map the control page first to learn the size of the ring
+	ring = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED)
+	{
+		perror("Error mapping device");
+		return -1;
+	}
+	size = ring->data_offset + ring->size * sizeof(struct tmp36_sample);
+	munmap(ring, sysconf(_SC_PAGESIZE));
+
+	ring = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED)
+	{
+		perror("Error mapping device");
+		return -1;
+	}
+	data = (struct tmp36_sample *)((char *)ring + ring->data_offset);
+	tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE); // Our own cursor, start with new samples
+
+	while (1)
+	{
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (head - tail > ring->size)
+		{
+			// The driver does not wait for us, these were overwritten
+			lost += head - ring->size - tail;
+			tail = head - ring->size;
+		}
+		for (; tail != head; ++tail)
+		{
+			struct tmp36_sample s = data[tail & (ring->size - 1)];
+			// Make sure the record was not overwritten while copying it, the fence
+			// keeps the copy before the load of head
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - tail >= ring->size)
+				break;
+			printf("[%lld.%09lld] AIN%u raw %u: %d mC\n", (long long)s.timestamp / 1000000000,
+					(long long)s.timestamp % 1000000000, s.channel, s.raw, s.millicelsius);
+		}
+		printf("Lost: %u\n", lost);
+		// Sleep until the driver stores a sample after our cursor
+		if (ioctl(fd, TMP36_IOC_SET_TAIL, &tail) < 0)
+		{
+			perror("Error setting the cursor");
+			return -1;
+		}
+		if (poll(&pfd, 1, -1) < 0)
+		{
+			perror("Error polling");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Read whole struct tmp36_sample records, no text formatting or parsing */
+int read_binary()
+{
+	struct tmp36_sample samples[512];
+	__u32 format = TMP36_FORMAT_BINARY;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int ret, i;
+
+	if (ioctl(fd, TMP36_IOC_SET_FORMAT, &format) < 0)
+	{
+		perror("Error selecting binary format");
+		return -1;
+	}
+	while (1)
+	{
+		if (poll(&pfd, 1, -1) < 0)
+		{
+			perror("Error polling");
+			return -1;
+		}
+		if ((ret = read(fd, samples, sizeof(samples))) < 0)
+		{
+			perror("Error reading");
+			return -1;
+		}
+		for (i = 0; i < ret / (int)sizeof(struct tmp36_sample); ++i)
+		{
+			printf("[%lld] AIN%u raw %u: %d mC\n", (long long)samples[i].timestamp,
+					samples[i].channel, samples[i].raw, samples[i].millicelsius);
+		}
+	}
+	return 0;
+}
+
+/* Print the last sample of every enabled channel, once per period */
+int read_scan()
+{
+	struct tmp36_scan scan;
+	struct tmp36_config cfg;
+	int ain;
+
+	if (ioctl(fd, TMP36_IOC_GET_CONFIG, &cfg) < 0)
+	{
+		perror("Error getting the sampling settings");
+		return -1;
+	}
+	while (1)
+	{
+		usleep(cfg.sample_period_us);
+		if (ioctl(fd, TMP36_IOC_SCAN, &scan) < 0)
+		{
+			perror("Error scanning");
+			continue;
+		}
+		printf("[%lld]", (long long)scan.timestamp);
+		for (ain = 0; ain < TMP36_NUM_AIN; ++ain)
+		{
+			if (scan.channels & (1 << ain))
+				printf(" AIN%d %d mC", ain, scan.millicelsius[ain]);
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
+/* Print the sampling settings, then change the ones given as arguments */
+int configure(int argc, char* argv[])
+{
+	struct tmp36_config cfg;
+
+	if (ioctl(fd, TMP36_IOC_GET_CONFIG, &cfg) < 0)
+	{
+		perror("Error getting the sampling settings");
+		return -1;
+	}
+	if (argc > 0)
+		cfg.sample_period_us = strtoul(argv[0], NULL, 0);
+	if (argc > 1)
+		cfg.hw_avg = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		cfg.fifo_depth = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		cfg.channels = strtoul(argv[3], NULL, 0);
+	if (argc > 0 && ioctl(fd, TMP36_IOC_SET_CONFIG, &cfg) < 0)
+	{
+		perror("Error setting the sampling settings");
+		return -1;
+	}
+	printf("period %u us, hw_avg %u, fifo_depth %u, channels 0x%02x, oversample %u, ema_shift %u\n",
+			cfg.sample_period_us, cfg.hw_avg, cfg.fifo_depth, cfg.channels,
+			cfg.oversample, cfg.ema_shift);
+	return 0;
+}
+
 int main(int argc, char* argv[])
 {
 	fd = open("/dev/tmp36", O_RDWR);
-	char buffer[100];	
+	char buffer[8192];
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
 	int ret;
 
 	if (signal(SIGINT, sig_handler) == SIG_ERR)
@@ -28,25 +194,59 @@ int main(int argc, char* argv[])
 		fprintf(stderr, "Could not catch signal\n");
 	}
 
+	if (argc > 1 && (!strcmp(argv[1], "-m") || !strcmp(argv[1], "-b")))
+	{
+		if (fd < 0)
+		{
+			perror("Error opening file");
+			return 1;
+		}
+		return (argv[1][1] == 'm') ? read_mmap() : read_binary();
+	}
+	if (argc > 1 && !strcmp(argv[1], "-s"))
+	{
+		if (fd < 0)
+		{
+			perror("Error opening file");
+			return 1;
+		}
+		return read_scan() ? 1 : 0;
+	}
+	if (argc > 1 && !strcmp(argv[1], "-c"))
+	{
+		// -c [period_us [hw_avg [fifo_depth [channel mask]]]]
+		if (fd < 0)
+		{
+			perror("Error opening file");
+			return 1;
+		}
+		return configure(argc - 2, argv + 2) ? 1 : 0;
+	}
+
 	while (1)
 	{
 		if ( fd >= 0)
 		{
-			if ( (ret = read (fd, buffer, 2)) < 0 )
+			if ( poll(&pfd, 1, -1) < 0 )
+			{
+				perror("Error polling");
+			}
+			else if ( (ret = read (fd, buffer, sizeof(buffer) - 1)) < 0 )
 			{
 				perror("Error reading");
 			}
 			else
 			{
-				buffer[2] = 0;
-				printf("Obtained sample: %s\n", buffer);
+				// One temperature in milli-degrees Celsius per line
+				buffer[ret] = 0;
+				printf("Obtained samples:\n%s", buffer);
 			}
 		}
 		else
 		{
 			perror("Error opening file");
+			return 1;
 		}
-		sleep(1);
 	}
 	return 0;
 }
@@ -7,6 +7,37 @@
  * @brief   A character driver to interact with the TMP36
  * temperature sensor. This kernel module shall be accessed
  * from user space and request the temperature from there.
+ *
+ * While the device is open, the analog inputs in the channels mask (AIN1, on
+ * P9_40, by default) are sampled from an hrtimer every sample_period_us
+ * microseconds into a shared history ring of timestamped samples, with
+ * 2^hw_avg conversions averaged by the ADC itself.
+ * Each of those samples can be the average of oversample conversions taken at
+ * oversample times the rate (a first-order CIC, i.e. boxcar, decimator) and be
+ * smoothed by an exponential moving average with a weight of 1/2^ema_shift.
+ * Filtering is done in Q8 fixed-point, so samples keep the extra resolution.
+ * Every open file has its own cursor into that history, so any number of
+ * readers each receive every sample. A read() returns as many of the samples
+ * after the file's cursor as fit in the user buffer, either as one temperature
+ * in milli-degrees Celsius per line or, once TMP36_IOC_SET_FORMAT selected
+ * TMP36_FORMAT_BINARY on the file, as packed struct tmp36_sample records. They
+ * are copied out of the ring through a per-file bounce buffer, so that the ring
+ * lock is not held while copying to user space. A read blocks (unless
+ * O_NONBLOCK) while there is no new sample; poll()/select()/epoll report POLLIN
+ * as soon as one is available. A reader that falls a whole ring behind loses
+ * its oldest samples, as well as any overwritten while it copied them.
+ * Alternatively the ring can be mmap()ed and consumed directly, see tmp36.h for
+ * its layout. The sampling settings, including the ring depth, are module
+ * parameters and can be changed at runtime with TMP36_IOC_SET_CONFIG.
+ *
+ * TMP36_IOC_SCAN returns the last sample of every enabled channel at once.
+ *
+ * The inputs are also registered as an IIO device (in_voltageN_raw/_scale,
+ * sampling_frequency) with a triggered buffer that scans any set of channels.
+ * The driver provides its own "tmp36-dev<N>" trigger, fired by the sampling
+ * timer, so that /dev/iio:device<N> streams every sample the char device sees.
+ * Any other IIO trigger (hrtimer, sysfs) works as well; the scan is then
+ * converted on demand, in one pass of the step sequencer.
  */
 
 #include <linux/init.h>
@@ -14,37 +45,204 @@
 #include <linux/device.h>
 #include <linux/kernel.h>
 #include <linux/gpio.h>
-#include <linux/random.h>
 #include <linux/fs.h>
+#include <linux/io.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/list.h>
+#include <linux/bitops.h>
+#include <linux/seqlock.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/kfifo.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <asm/uaccess.h>
 
+#include "am335x.h"
+#include "tmp36.h"
+
+#define CREATE_TRACE_POINTS
+#include "tmp36_trace.h"
+
 #define  DEVICE_NAME "tmp36" //device under /dev
 #define  CLASS_NAME  "tmp36-drv"
 
+#define  TMP36_AIN        (1)  // AIN1, on P9_40, the default channel
+#define  TMP36_READ_CHUNK (32) // Samples copied out at a time in dev_read
+#define  TMP36_TEXT_MAX   (8)  // Longest formatted sample, i.e. "-50000\n"
+#define  TMP36_MIN_PERIOD_US (100) // Shortest timer tick
+#define  TMP36_CONV_US       (10)  // One conversion: 16 sampling + 13 conversion ADC clocks at 3MHz
+#define  TMP36_MAX_HW_AVG    (4)   // ADC_AVG16
+#define  TMP36_MAX_FIFO_DEPTH (65536)
+#define  TMP36_MAX_OVERSAMPLE (64)
+#define  TMP36_MAX_EMA_SHIFT  (8)
+#define  TMP36_Q              (8)   // Fraction bits of the filtered samples
+#define  TMP36_TRIG_FIFO      (16)  // Passes queued for the trigger handler, a power of 2
+
+/* ADC_TSC registers not covered by am335x.h */
+#define  ADC_TSC_SIZE          (0x1000)
+#define  ADC_CLKDIV            (ADC_TSC+0x4C)
+#define  ADC_FIFO0COUNT        (ADC_TSC+0xE4)
+#define  ADC_FIFO_COUNT_MASK   (0x7F)
+#define  ADC_CTRL_ENABLE       (0x01)
+#define  ADC_CTRL_STEP_ID_TAG  (0x01<<1)
+#define  ADC_STEPCONFIG(step)  (ADCSTEPCONFIG1 + (step)*8)
+#define  ADC_STEPDELAY(step)   (ADCSTEPDELAY1 + (step)*8)
+#define  ADC_STEP_SEL_INP(ain) ((ain)<<19)
+#define  ADC_STEP_AVG(log2n)   ((log2n)<<2) // Hardware averaging of 2^log2n conversions
+#define  ADC_STEP_ENABLE(step) (0x01<<((step)+1))
+#define  ADC_STEPS_ENABLE(mask) ((mask)<<1) // One step per AIN, step n converts AINn
+#define  ADC_FIFO_STEP_ID(word) (((word)>>16) & 0x0F)
+
+#define  adc_read(reg)       ioread32(adc_base + ((reg) - ADC_TSC))
+#define  adc_write(val, reg) iowrite32((val), adc_base + ((reg) - ADC_TSC))
+
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Santiago Pagola");
 MODULE_DESCRIPTION("Linux driver for the TMP36 temperature sensor with Beaglebone Black");
 MODULE_VERSION("0.1");
 
+static unsigned int sample_period_us = 1000;
+module_param(sample_period_us, uint, S_IRUGO);
+MODULE_PARM_DESC(sample_period_us, " Sampling period of every enabled channel in microseconds (default=1000), also sampling_frequency of the IIO device");
+
+static unsigned int hw_avg = 4;
+module_param(hw_avg, uint, S_IRUGO);
+MODULE_PARM_DESC(hw_avg, " Hardware averaging of 2^hw_avg conversions per step, 0 to 4 (default=4, i.e. ADC_AVG16)");
+
+static unsigned int channels = BIT(TMP36_AIN);
+module_param(channels, uint, S_IRUGO);
+MODULE_PARM_DESC(channels, " Mask of the sampled analog inputs, bit n for AINn (default=0x02, AIN1)");
+
+static unsigned int oversample = 1;
+module_param(oversample, uint, S_IRUGO);
+MODULE_PARM_DESC(oversample, " Conversions averaged into each sample, a power of 2 up to 64 (default=1)");
+
+static unsigned int ema_shift = 0;
+module_param(ema_shift, uint, S_IRUGO);
+MODULE_PARM_DESC(ema_shift, " Exponential moving average weight of 1/2^ema_shift, 0 disables it, up to 8 (default=0)");
+
+static unsigned int fifo_depth = 4096;
+module_param(fifo_depth, uint, S_IRUGO);
+MODULE_PARM_DESC(fifo_depth, " Number of samples buffered between reads, rounded up to a power of 2 (default=4096)");
+
 static int    majorNumber;
-static char   cmd_out[10] = {0}; // Value of temperature sent back to user space
-static size_t size_out; //Size of outcoming buffer
-static int    openCnt = 0; // Counts the number of times the temperature has been requested
+static int    openCnt = 0; // Counts the number of times the device is currently opened
+static int    sampler_users = 0; // Open files plus the IIO trigger, the timer runs while non-zero
 static struct class*  tmp36Class  = NULL; // The device-driver class struct pointer
 static struct device* tmp36Device = NULL; // The device-driver device struct pointer
 
+static void __iomem *adc_base; // ADC_TSC registers
+static struct hrtimer sample_timer; // Periodic sampling of the enabled channels
+static ktime_t tick_period; // sample_period_us / oversample, one conversion per tick
+static ktime_t conv_start; // When the conversion collected on the next tick was started
+
+/** Filter state per channel, only touched by sample_timer or while it is stopped */
+static struct {
+	u32 acc;   // Sum of the conversions of the current decimation window
+	u32 count; // Conversions in the current window
+	s64 start; // When the first conversion of the window was started
+	s32 ema;   // Moving average, Q8
+	bool primed; // ema holds a value
+} filt[TMP36_NUM_AIN];
+static struct tmp36_scan latest; // Last sample of every channel, from the last pass over the mask
+static seqcount_t latest_seq = SEQCNT_ZERO(latest_seq); // Written by sample_timer, or while it is stopped
+
+/** The sample ring is a single vmalloc_user() area that can be mapped to user space:
+ *  the struct tmp36_ring control page followed by ring_size records. The sampling
+ *  timer is the only writer and always overwrites the oldest record; readers keep
+ *  their own cursors. The driver keeps its own copy of the ring state and only ever
+ *  publishes into the control page, user space maps it read-only.
+ */
+static struct tmp36_ring   *ring;
+static struct tmp36_sample *ring_data;
+static size_t ring_bytes;
+static u32    ring_size; // Number of records, a power of 2
+static u32    ring_head; // Samples produced so far
+static atomic_t ring_maps = ATOMIC_INIT(0); // User mappings of the ring, which cannot be resized meanwhile
+static DECLARE_RWSEM(ring_sem); // Held for writing while the ring is reallocated, for reading while it is copied out
+static DECLARE_WAIT_QUEUE_HEAD(tmp36_wq); // Readers waiting for samples
+static DEFINE_MUTEX(sampler_lock); // Protects openCnt, sampler_users, readers, the sampling settings and ADC one-shot conversions
+static LIST_HEAD(readers); // Every open file
+
+static struct iio_dev     *tmp36_iio;  // The IIO side of the driver
+static struct iio_trigger *tmp36_trig; // Fired by sample_timer for every new sample
+static bool trig_enabled = false;      // An IIO buffer is attached to tmp36_trig
+static DEFINE_KFIFO(trig_fifo, struct tmp36_scan, TMP36_TRIG_FIFO); // Passes of sample_timer, for the trigger handler
+static unsigned int trig_overruns = 0; // Passes dropped because trig_fifo was full
+
+/** Per open file state, in filep->private_data */
+struct tmp36_reader {
+	struct list_head node; // In readers
+	struct mutex lock; // Serializes reads sharing this file, never other readers
+	u32 format;        // TMP36_FORMAT_TEXT or TMP36_FORMAT_BINARY
+	u32 tail;          // Next sample this file will read
+	u32 lost;          // Samples overwritten before this file read them, or dropped by a faulting read
+	struct tmp36_sample bounce[TMP36_READ_CHUNK]; // Samples on their way to user space
+};
+
 // Prototype functions for the character driver
 static int     dev_open(struct inode *, struct file *);
 static int     dev_release(struct inode *, struct file *);
 static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
 static ssize_t dev_write(struct file *, const char*, size_t, loff_t *);
+static int     dev_mmap(struct file *, struct vm_area_struct *);
+static unsigned int dev_poll(struct file *, poll_table *);
+static long    dev_ioctl(struct file *, unsigned int, unsigned long);
+static u32     ring_copy(struct tmp36_reader *, u32);
+static ssize_t read_text(struct tmp36_reader *, char *, size_t);
+static ssize_t read_binary(struct tmp36_reader *, char *, size_t);
+
+//ADC handling
+static int  adc_setup(void);
+static void adc_release(void);
+static void adc_flush(void);
+static void adc_program_steps(void);
+static int  adc_scan_conversion(u32 mask, u16 *raw);
+static enum hrtimer_restart sample_timer_cb(struct hrtimer *);
+static void sampler_get(void);
+static void sampler_put(void);
+static int  sampler_check(const struct tmp36_config *);
+static void sampler_get_config(struct tmp36_config *);
+static int  sampler_configure(const struct tmp36_config *);
+static void filter_reset(void);
+static bool filter_push(unsigned int ain, u16 raw, s64 timestamp);
+static int  sampler_scan(u32 mask, struct tmp36_scan *);
+static int  sampler_latest(unsigned int ain, u16 *raw);
+
+//IIO device
+static int  tmp36_iio_setup(void);
+static void tmp36_iio_release(void);
 
+//Sample ring
+static int  ring_alloc(unsigned int depth);
+static int  ring_resize(unsigned int depth);
+static void ring_reset(void);
+static void ring_push(unsigned int ain, u32 value, s64 timestamp);
+static u32  ring_avail(struct tmp36_reader *);
 
 static struct file_operations fops =
 {
+	.owner = THIS_MODULE,
 	.open = dev_open,
 	.read = dev_read,
 	.write = dev_write,
+	.mmap = dev_mmap,
+	.poll = dev_poll,
+	.unlocked_ioctl = dev_ioctl,
 	.release = dev_release,
 };
 
@@ -55,13 +253,41 @@ static struct file_operations fops =
  */
 static int __init tmp36_init(void)
 {
+	struct tmp36_config cfg;
+	int result = 0;
 	printk(KERN_INFO "TMP36: Initializing the tmp36 driver\n");
 
+	sampler_get_config(&cfg);
+	if (sampler_check(&cfg))
+	{
+		printk(KERN_ALERT "TMP36: invalid sampling settings\n");
+		return -EINVAL;
+	}
+	tick_period = ns_to_ktime(div_u64((u64)sample_period_us * NSEC_PER_USEC, oversample));
+	hrtimer_init(&sample_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sample_timer.function = sample_timer_cb;
+
+	result = ring_alloc(fifo_depth);
+	if (result)
+	{
+		printk(KERN_ALERT "TMP36: failed to allocate the sample ring\n");
+		return result;
+	}
+
+	// Set up the analog pin P9_40
+	result = adc_setup();
+	if (result)
+	{
+		printk(KERN_ALERT "TMP36: failed to set up the ADC\n");
+		goto out_ring;
+	}
+
 	majorNumber = register_chrdev(0, DEVICE_NAME, &fops);
 	if (majorNumber < 0)
 	{
 		printk(KERN_ALERT "tmp36 driver failed to register major number\n");
-		return majorNumber;
+		result = majorNumber;
+		goto out_adc;
 	}
 	printk(KERN_INFO "TMP36: registered correctly with major number %d\n", majorNumber);
 
@@ -69,9 +295,9 @@ static int __init tmp36_init(void)
 	tmp36Class = class_create(THIS_MODULE, CLASS_NAME);
 	if ( IS_ERR(tmp36Class) )
 	{
-		unregister_chrdev(majorNumber, DEVICE_NAME);
 		printk(KERN_ALERT "Failed to register device class\n");
-		return PTR_ERR(tmp36Class);
+		result = PTR_ERR(tmp36Class);
+		goto out_chrdev;
 	}
 	printk(KERN_INFO "TMP36: device class registered correctly\n");
 
@@ -79,14 +305,33 @@ static int __init tmp36_init(void)
 	tmp36Device = device_create(tmp36Class, NULL, MKDEV(majorNumber, 0), NULL, DEVICE_NAME);
 	if ( IS_ERR(tmp36Device) )
 	{
-		class_destroy(tmp36Class);
-		unregister_chrdev(majorNumber, DEVICE_NAME);
 		printk(KERN_ALERT "Failed to create the device\n");
-		return PTR_ERR(tmp36Device);
+		result = PTR_ERR(tmp36Device);
+		goto out_class;
 	}
 	printk(KERN_INFO "TMP36: device class created correctly\n");
-	// Set up the analog pin P9_40
+
+	// And the IIO device on top of it
+	result = tmp36_iio_setup();
+	if (result)
+	{
+		printk(KERN_ALERT "TMP36: Failed to register the IIO device\n");
+		goto out_device;
+	}
+	printk(KERN_INFO "TMP36: IIO device registered correctly\n");
 	return 0;
+
+out_device:
+	device_destroy(tmp36Class, MKDEV(majorNumber, 0));
+out_class:
+	class_destroy(tmp36Class);
+out_chrdev:
+	unregister_chrdev(majorNumber, DEVICE_NAME);
+out_adc:
+	adc_release();
+out_ring:
+	vfree(ring);
+	return result;
 }
 
 /** @function tmp36_exit
@@ -95,55 +340,769 @@ static int __init tmp36_init(void)
  */
 static void __exit tmp36_exit(void)
 {
+	tmp36_iio_release(); // Needs tmp36Device, its parent
 	device_destroy(tmp36Class, MKDEV(majorNumber, 0)); // remove the device
 	class_unregister(tmp36Class); // unregister the device class
 	class_destroy(tmp36Class); // remove the device class
 	unregister_chrdev(majorNumber, DEVICE_NAME); // unregister the major number
+	hrtimer_cancel(&sample_timer); // should already be stopped, all users are gone
+	adc_release();
+	vfree(ring);
+	printk(KERN_INFO "TMP36: # trigger passes dropped: %u\n", trig_overruns);
 	printk(KERN_INFO "TMP36: Exiting now\n");
 }
 
+/** @function adc_setup
+ *  @brief Enables the ADC_TSC clock module, maps its registers and programs one
+ *  software-enabled one-shot step per analog input
+ *  @return 0 on success, -ENOMEM or -ETIMEDOUT otherwise
+ */
+static int adc_setup(void)
+{
+	void __iomem *clkctrl;
+	unsigned int timeout = 100;
+
+	// enable the CM_WKUP_ADC_TSC_CLKCTRL with CM_WKUP_MODULEMODE_ENABLE
+	clkctrl = ioremap(CM_WKUP_ADC_TSC_CLKCTRL, GPIO_REGISTER_SIZE);
+	if (!clkctrl)
+		return -ENOMEM;
+	iowrite32(ioread32(clkctrl) | CM_WKUP_MODULEMODE_ENABLE, clkctrl);
+	// wait for the module to become functional
+	while ((ioread32(clkctrl) & CM_WKUP_IDLEST_DISABLED) && --timeout)
+		udelay(10);
+	iounmap(clkctrl);
+	if (!timeout)
+		return -ETIMEDOUT;
+
+	adc_base = ioremap(ADC_TSC, ADC_TSC_SIZE);
+	if (!adc_base)
+		return -ENOMEM;
+
+	// Disable the ADC and make sure STEPCONFIG write protect is off
+	adc_write(ADC_STEPCONFIG_WRITE_PROTECT_OFF, ADC_CTRL);
+	adc_write(0, ADC_STEPENABLE);
+	adc_write(7, ADC_CLKDIV); // 24MHz / 8 = 3MHz ADC clock
+	adc_program_steps();
+	adc_flush();
+	// enable the ADC
+	adc_write(ADC_STEPCONFIG_WRITE_PROTECT_OFF | ADC_CTRL_STEP_ID_TAG | ADC_CTRL_ENABLE, ADC_CTRL);
+	return 0;
+}
+
+/** @function adc_release
+ *  @brief Stops the step sequencer, disables the ADC and unmaps its registers
+ */
+static void adc_release(void)
+{
+	adc_write(0, ADC_STEPENABLE);
+	adc_write(ADC_STEPCONFIG_WRITE_PROTECT_OFF, ADC_CTRL);
+	iounmap(adc_base);
+}
+
+/** @function adc_flush
+ *  @brief Throws away whatever was left in FIFO0
+ */
+static void adc_flush(void)
+{
+	while (adc_read(ADC_FIFO0COUNT) & ADC_FIFO_COUNT_MASK)
+		adc_read(ADC_FIFO0DATA);
+}
+
+/** @function adc_program_steps
+ *  @brief Programs step n to convert AINn with the current hardware averaging.
+ *  All eight steps are always programmed, the sampling timer only enables the
+ *  ones in the channel mask. Called while the sampling timer is stopped.
+ */
+static void adc_program_steps(void)
+{
+	unsigned int ain;
+
+	for (ain = 0; ain < TMP36_NUM_AIN; ++ain)
+	{
+		adc_write(ADC_STEP_SEL_INP(ain) | ADC_STEP_AVG(hw_avg), ADC_STEPCONFIG(ain));
+		adc_write((0x0F)<<24, ADC_STEPDELAY(ain));
+	}
+}
+
+/** @function adc_scan_conversion
+ *  @brief Converts a set of channels on demand in one pass of the step sequencer,
+ *  only while the sampling timer is stopped. Called with sampler_lock held.
+ *  @param mask The analog inputs to convert, bit n for AINn
+ *  @param raw Where to store the 12-bit ADC codes, indexed by AIN
+ *  @return 0 on success, -ETIMEDOUT if the conversions did not complete
+ */
+static int adc_scan_conversion(u32 mask, u16 *raw)
+{
+	unsigned int timeout = 50 * hweight32(mask);
+	unsigned int ain;
+	u32 word, pending = mask;
+
+	adc_flush();
+	adc_write(ADC_STEPS_ENABLE(mask), ADC_STEPENABLE);
+	while (pending)
+	{
+		if (!(adc_read(ADC_FIFO0COUNT) & ADC_FIFO_COUNT_MASK))
+		{
+			if (!--timeout)
+				return -ETIMEDOUT;
+			usleep_range(20, 40);
+			continue;
+		}
+		word = adc_read(ADC_FIFO0DATA);
+		ain = ADC_FIFO_STEP_ID(word);
+		if (ain < TMP36_NUM_AIN && (pending & BIT(ain)))
+		{
+			raw[ain] = word & ADC_FIFO_MASK;
+			pending &= ~BIT(ain);
+		}
+	}
+	return 0;
+}
+
+/** @function tmp36_millicelsius
+ *  @brief Converts an ADC code into milli-degrees Celsius. The ADC reference
+ *  is 1.8V, so mV = raw * 1800 / 4096, and the TMP36 outputs 500mV + 10mV/C
+ *  @param value The ADC code in Q8 fixed-point, 0..4095 << 8
+ *  @return the temperature in milli-degrees Celsius
+ */
+static inline int tmp36_millicelsius(u32 value)
+{
+	return (int)(((u64)value * 5625) >> (7 + TMP36_Q)) - 50000;
+}
+
+/** @function ring_alloc
+ *  @brief Allocates an empty sample ring, at least one page worth of records, in
+ *  place of the current one, which is only freed on success. Called while the
+ *  sampling timer is stopped and nobody can be copying out of the ring.
+ *  @param depth The requested number of records
+ *  @return 0 on success, -ENOMEM otherwise
+ */
+static int ring_alloc(unsigned int depth)
+{
+	struct tmp36_ring *new_ring;
+	u32 size;
+	size_t bytes;
+
+	size = roundup_pow_of_two(max_t(unsigned int, depth,
+				PAGE_SIZE / sizeof(struct tmp36_sample)));
+	bytes = PAGE_SIZE + size * sizeof(struct tmp36_sample);
+	new_ring = vmalloc_user(bytes); // zeroed and page aligned
+	if (!new_ring)
+		return -ENOMEM;
+	new_ring->version = TMP36_RING_VERSION;
+	new_ring->size = size;
+	new_ring->data_offset = PAGE_SIZE;
+
+	vfree(ring);
+	ring = new_ring;
+	ring_data = (struct tmp36_sample *)((char *)ring + PAGE_SIZE);
+	ring_size = size;
+	ring_bytes = bytes;
+	ring_head = 0;
+	fifo_depth = size;
+	return 0;
+}
+
+/** @function ring_resize
+ *  @brief Replaces the ring with an empty one of another size and moves every
+ *  reader to its start. Called with sampler_lock held and the sampling timer stopped.
+ *  @param depth The requested number of records
+ *  @return 0 on success, -EBUSY while the ring is mapped, -ENOMEM otherwise
+ */
+static int ring_resize(unsigned int depth)
+{
+	struct tmp36_reader *reader;
+	int ret;
+
+	down_write(&ring_sem);
+	if (atomic_read(&ring_maps))
+	{
+		ret = -EBUSY; // The mappings would keep pointing at the old ring
+	}
+	else
+	{
+		ret = ring_alloc(depth);
+		if (!ret)
+		{
+			list_for_each_entry(reader, &readers, node)
+				WRITE_ONCE(reader->tail, 0);
+		}
+	}
+	up_write(&ring_sem);
+	return ret;
+}
+
+/** @function ring_reset
+ *  @brief Empties the ring, only called while the sampling timer is stopped
+ */
+static void ring_reset(void)
+{
+	ring_head = 0;
+	ring->head = 0;
+}
+
+/** @function ring_push
+ *  @brief Stores one sample over the oldest one
+ *  @param ain The analog input the sample was taken from
+ *  @param value The (filtered) ADC code in Q8 fixed-point
+ *  @param timestamp When the sample was taken, in ns
+ */
+static void ring_push(unsigned int ain, u32 value, s64 timestamp)
+{
+	struct tmp36_sample *rec;
+
+	rec = &ring_data[ring_head & (ring_size - 1)];
+	rec->timestamp = timestamp;
+	rec->millicelsius = tmp36_millicelsius(value);
+	rec->raw = min_t(u32, (value + (1 << (TMP36_Q - 1))) >> TMP36_Q, ADC_FIFO_MASK); // Rounded
+	rec->channel = ain;
+	latest.raw[ain] = rec->raw;
+	latest.millicelsius[ain] = rec->millicelsius;
+	latest.channels |= BIT(ain);
+	latest.timestamp = timestamp;
+	trace_tmp36_sample(ain, rec->raw, rec->millicelsius, timestamp);
+	// Publish the record before the new head
+	smp_store_release(&ring_head, ring_head + 1);
+	smp_store_release(&ring->head, ring_head);
+}
+
+/** @function ring_avail
+ *  @brief Number of samples the reader can read. A reader that fell a whole ring
+ *  behind is moved forward to half a ring behind the head, to give it room to catch
+ *  up. Called with reader->lock and ring_sem held.
+ *  @param reader The reader
+ *  @return the number of samples, at most ring_size
+ */
+static u32 ring_avail(struct tmp36_reader *reader)
+{
+	u32 head = smp_load_acquire(&ring_head);
+
+	if (head - reader->tail > ring_size)
+	{
+		reader->lost += head - ring_size / 2 - reader->tail;
+		reader->tail = head - ring_size / 2;
+	}
+	return head - reader->tail;
+}
+
+/** @function filter_reset
+ *  @brief Starts a new decimation window and forgets the moving average, on every channel
+ */
+static void filter_reset(void)
+{
+	memset(filt, 0, sizeof(filt));
+}
+
+/** @function filter_push
+ *  @brief Feeds one conversion through the decimator and the moving average and
+ *  stores a sample in the ring every oversample conversions. Integer only: the
+ *  boxcar sum is scaled to Q8 with a shift, as oversample is a power of 2, and the
+ *  EMA is y += (x - y) / 2^ema_shift.
+ *  @param ain The analog input the conversion was taken from
+ *  @param raw The 12-bit ADC code
+ *  @param timestamp When the conversion was started, in ns
+ *  @return true if a sample was stored
+ */
+static bool filter_push(unsigned int ain, u16 raw, s64 timestamp)
+{
+	s32 x;
+
+	if (!filt[ain].count)
+		filt[ain].start = timestamp;
+	filt[ain].acc += raw;
+	if (++filt[ain].count < oversample)
+		return false;
+
+	x = (filt[ain].acc << TMP36_Q) >> ilog2(oversample);
+	// The window average belongs to the middle of the window
+	timestamp = filt[ain].start + ((timestamp - filt[ain].start) >> 1);
+	filt[ain].acc = 0;
+	filt[ain].count = 0;
+
+	if (ema_shift)
+	{
+		if (filt[ain].primed)
+			filt[ain].ema += (x - filt[ain].ema) >> ema_shift;
+		else
+			filt[ain].ema = x;
+		filt[ain].primed = true;
+		x = filt[ain].ema;
+	}
+	ring_push(ain, x, timestamp);
+	return true;
+}
+
+/** @function sample_timer_cb
+ *  @brief Periodic sampling of the enabled channels. Conversions are pipelined: every
+ *  tick collects the results of the pass over the channel mask started on the previous
+ *  tick, feeds them through the filters into the ring and starts the next pass, so the
+ *  timer never busy-waits on the ADC. The FIFO words are tagged with their step, which
+ *  is also their channel.
+ *  @param timer The hrtimer that expired (sample_timer)
+ *  @return HRTIMER_RESTART, the timer is only stopped when the device is released
+ */
+static enum hrtimer_restart sample_timer_cb(struct hrtimer *timer)
+{
+	unsigned int count, ain;
+	u32 word;
+	bool pushed = false;
+
+	count = adc_read(ADC_FIFO0COUNT) & ADC_FIFO_COUNT_MASK;
+	write_seqcount_begin(&latest_seq);
+	while (count--)
+	{
+		word = adc_read(ADC_FIFO0DATA);
+		ain = ADC_FIFO_STEP_ID(word);
+		if (ain >= TMP36_NUM_AIN || !(channels & BIT(ain)))
+			continue; // Left over from before the last reconfiguration
+		if (filter_push(ain, word & ADC_FIFO_MASK, ktime_to_ns(conv_start)))
+			pushed = true;
+	}
+	write_seqcount_end(&latest_seq);
+	conv_start = ktime_get();
+	adc_write(ADC_STEPS_ENABLE(channels), ADC_STEPENABLE);
+
+	if (pushed)
+	{
+		wake_up_interruptible(&tmp36_wq);
+		if (trig_enabled)
+		{
+			// A copy of this very pass, the handler may only run after the next ones
+			if (!kfifo_put(&trig_fifo, latest))
+				trig_overruns++;
+			iio_trigger_poll(tmp36_trig);
+		}
+	}
+	hrtimer_forward_now(timer, tick_period);
+	return HRTIMER_RESTART;
+}
+
+/** @function sampler_get
+ *  @brief Adds a user of the sampling timer, the first one starts it on an empty
+ *  ring. Called with sampler_lock held.
+ */
+static void sampler_get(void)
+{
+	if (sampler_users++ == 0)
+	{
+		ring_reset();
+		filter_reset();
+		write_seqcount_begin(&latest_seq);
+		latest.channels = 0;
+		write_seqcount_end(&latest_seq);
+		adc_flush(); // A conversion may still have been running when the timer was stopped
+		hrtimer_start(&sample_timer, tick_period, HRTIMER_MODE_REL);
+	}
+}
+
+/** @function sampler_put
+ *  @brief Drops a user of the sampling timer, the last one stops it.
+ *  Called with sampler_lock held.
+ */
+static void sampler_put(void)
+{
+	if (--sampler_users == 0)
+		hrtimer_cancel(&sample_timer); // Nobody left to read the samples
+}
+
+/** @function sampler_check
+ *  @brief Validates sampling settings. Every tick must leave the ADC enough time
+ *  to convert all enabled channels with the requested hardware averaging.
+ *  @param cfg The settings
+ *  @return 0 if the settings are valid, -EINVAL otherwise
+ */
+static int sampler_check(const struct tmp36_config *cfg)
+{
+	unsigned int min_tick;
+
+	if (!is_power_of_2(cfg->oversample) || cfg->oversample > TMP36_MAX_OVERSAMPLE ||
+			cfg->ema_shift > TMP36_MAX_EMA_SHIFT || cfg->hw_avg > TMP36_MAX_HW_AVG)
+		return -EINVAL;
+	if (!cfg->channels || cfg->channels >= BIT(TMP36_NUM_AIN))
+		return -EINVAL;
+	if (!cfg->fifo_depth || cfg->fifo_depth > TMP36_MAX_FIFO_DEPTH)
+		return -EINVAL;
+	min_tick = max_t(unsigned int, TMP36_MIN_PERIOD_US,
+			hweight32(cfg->channels) * (TMP36_CONV_US << cfg->hw_avg));
+	if (cfg->sample_period_us / cfg->oversample < min_tick)
+		return -EINVAL;
+	return 0;
+}
+
+/** @function sampler_get_config
+ *  @brief Gets the current sampling settings
+ *  @param cfg Where to store them
+ */
+static void sampler_get_config(struct tmp36_config *cfg)
+{
+	cfg->sample_period_us = READ_ONCE(sample_period_us);
+	cfg->hw_avg = READ_ONCE(hw_avg);
+	cfg->fifo_depth = READ_ONCE(fifo_depth);
+	cfg->channels = READ_ONCE(channels);
+	cfg->oversample = READ_ONCE(oversample);
+	cfg->ema_shift = READ_ONCE(ema_shift);
+}
+
+/** @function sampler_configure
+ *  @brief Changes the sampling settings, restarting the timer with fresh filter
+ *  state if it is running. A new fifo_depth also empties the ring.
+ *  @param cfg The new settings
+ *  @return 0 on success, -EINVAL on invalid settings, -EBUSY or -ENOMEM if the ring
+ *  could not be resized, in which case nothing is changed
+ */
+static int sampler_configure(const struct tmp36_config *cfg)
+{
+	int ret;
+
+	ret = sampler_check(cfg);
+	if (ret)
+	{
+		trace_tmp36_configure(cfg, ret);
+		return ret;
+	}
+	mutex_lock(&sampler_lock);
+	if (sampler_users)
+		hrtimer_cancel(&sample_timer);
+	if (roundup_pow_of_two(max_t(unsigned int, cfg->fifo_depth,
+				PAGE_SIZE / sizeof(struct tmp36_sample))) != ring_size)
+	{
+		ret = ring_resize(cfg->fifo_depth);
+		if (ret)
+			goto out;
+	}
+	sample_period_us = cfg->sample_period_us;
+	oversample = cfg->oversample;
+	ema_shift = cfg->ema_shift;
+	hw_avg = cfg->hw_avg;
+	channels = cfg->channels;
+	tick_period = ns_to_ktime(div_u64((u64)sample_period_us * NSEC_PER_USEC, oversample));
+	adc_program_steps();
+	filter_reset();
+	write_seqcount_begin(&latest_seq);
+	latest.channels &= channels;
+	write_seqcount_end(&latest_seq);
+out:
+	if (sampler_users)
+	{
+		adc_flush();
+		hrtimer_start(&sample_timer, tick_period, HRTIMER_MODE_REL);
+	}
+	trace_tmp36_configure(cfg, ret);
+	mutex_unlock(&sampler_lock);
+	return ret;
+}
+
+/** @function sampler_scan
+ *  @brief Gets the most recent sample of a set of channels: the last pass of the
+ *  sampling timer over its channel mask while it runs, a fresh one-shot pass of the
+ *  step sequencer otherwise
+ *  @param mask The analog inputs, bit n for AINn
+ *  @param scan Where to store the samples, scan->channels tells which ones are valid
+ *  @return 0 on success, -EBUSY if the timer does not sample all of the channels,
+ *  -EAGAIN if it has not sampled any of them yet, -ETIMEDOUT otherwise
+ */
+static int sampler_scan(u32 mask, struct tmp36_scan *scan)
+{
+	unsigned int seq, ain;
+	int ret = 0;
+
+	mutex_lock(&sampler_lock);
+	if (sampler_users)
+	{
+		if (mask & ~channels)
+		{
+			ret = -EBUSY; // The sequencer is busy with the other channels
+		}
+		else
+		{
+			do
+			{
+				seq = read_seqcount_begin(&latest_seq);
+				*scan = latest;
+			} while (read_seqcount_retry(&latest_seq, seq));
+			scan->channels &= mask;
+			if (!scan->channels)
+				ret = -EAGAIN; // The first pass is still being converted
+		}
+	}
+	else
+	{
+		memset(scan, 0, sizeof(*scan));
+		scan->timestamp = ktime_get_ns();
+		ret = adc_scan_conversion(mask, scan->raw);
+		if (!ret)
+		{
+			scan->channels = mask;
+			for (ain = 0; ain < TMP36_NUM_AIN; ++ain)
+			{
+				if (mask & BIT(ain))
+					scan->millicelsius[ain] = tmp36_millicelsius(scan->raw[ain] << TMP36_Q);
+			}
+		}
+	}
+	mutex_unlock(&sampler_lock);
+	return ret;
+}
+
+/** @function sampler_latest
+ *  @brief Gets the most recent sample of a single channel, see sampler_scan
+ *  @param ain The analog input
+ *  @param raw Where to store the 12-bit ADC code
+ *  @return 0 on success, a negative error code otherwise
+ */
+static int sampler_latest(unsigned int ain, u16 *raw)
+{
+	struct tmp36_scan scan;
+	int ret;
+
+	ret = sampler_scan(BIT(ain), &scan);
+	if (!ret)
+		*raw = scan.raw[ain];
+	return ret;
+}
+
 /** @function dev_open
  *  @brief The device open function that is called each time the device is opened
- *  This will only increment the numberOpens counter in this case.
+ *  Every open file is a user of the sampling timer.
  *  @param inodep A pointer to an inode object (defined in linux/fs.h)
  *  @param filep A pointer to a file object (defined in linux/fs.h)
  */
 static int dev_open(struct inode *inodep, struct file *filep)
 {
+	struct tmp36_reader *reader;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+	mutex_init(&reader->lock);
+	reader->format = TMP36_FORMAT_TEXT;
+	filep->private_data = reader;
+
+	if (mutex_lock_interruptible(&sampler_lock))
+	{
+		kfree(reader);
+		return -ERESTARTSYS;
+	}
 	openCnt++;
-	printk(KERN_INFO "TMP36: Temperature request count: %d\n", openCnt);
+	sampler_get();
+	list_add(&reader->node, &readers);
+	reader->tail = smp_load_acquire(&ring_head); // Only samples taken from now on
+	trace_tmp36_open(openCnt);
+	mutex_unlock(&sampler_lock);
 	return 0;
 }
 
 /** @function dev_read
  *  @brief Function to be used to copy a given buffer to user space (i.e. when
- *  user space has requested a read operation from this device) 
+ *  user space has requested a read operation from this device). Drains as many
+ *  buffered samples as fit in the buffer, in the format selected for this file.
  *  @param filep A pointer to a file object (defined in linux/fs.h)
  *  @param buffer The pointer to the buffer to which this function writes the data
- *  @param len The length of the b
+ *  @param len The length of the buffer, room for at least one sample
  *  @param offset The offset if required
+ *  @return the number of bytes copied, or a negative error code
  */
 static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *offset)
 {
+	struct tmp36_reader *reader = filep->private_data;
+	ktime_t start = trace_tmp36_read_enabled() ? ktime_get() : 0;
+	bool binary = reader->format == TMP36_FORMAT_BINARY;
+	ssize_t ret;
+
+	if (len < (binary ? sizeof(struct tmp36_sample) : TMP36_TEXT_MAX))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&reader->lock))
+		return -ERESTARTSYS;
+again:
+	down_read(&ring_sem);
+	while (!ring_avail(reader))
+	{
+		up_read(&ring_sem);
+		mutex_unlock(&reader->lock);
+		if (filep->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(tmp36_wq, smp_load_acquire(&ring_head) != READ_ONCE(reader->tail)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&reader->lock))
+			return -ERESTARTSYS;
+		down_read(&ring_sem);
+	}
+	up_read(&ring_sem);
+	ret = binary ? read_binary(reader, buffer, len) : read_text(reader, buffer, len);
+	if (!ret)
+		goto again; // A resize emptied the ring since it was checked
+	trace_tmp36_read(reader->format, ret, reader->lost, start);
+	mutex_unlock(&reader->lock);
+	return ret;
+}
+
+/** @function ring_copy
+ *  @brief Copies samples after the reader's cursor into its bounce buffer and moves
+ *  the cursor past them. The sampling timer keeps running meanwhile, so the head is
+ *  checked again once they are copied: records it may have overwritten are dropped
+ *  and counted as lost. ring_sem is only held for the copy, never while copy_to_user()
+ *  can fault and take mmap_sem. Called with reader->lock held.
+ *  @param reader The reader
+ *  @param max The most samples to copy, at most TMP36_READ_CHUNK
+ *  @return the number of samples copied
+ */
+static u32 ring_copy(struct tmp36_reader *reader, u32 max)
+{
+	u32 idx, n, first, head, torn;
+
+	down_read(&ring_sem);
+	do
+	{
+		n = min(max, ring_avail(reader));
+		idx = reader->tail & (ring_size - 1);
+		first = min(n, ring_size - idx);
+		memcpy(reader->bounce, &ring_data[idx], first * sizeof(*ring_data));
+		memcpy(reader->bounce + first, ring_data, (n - first) * sizeof(*ring_data));
+		// Only records less than ring_size behind the head were not overwritten meanwhile
+		smp_rmb();
+		head = READ_ONCE(ring_head);
+		torn = min_t(u32, n, max_t(s32, head - ring_size + 1 - reader->tail, 0));
+		if (torn)
+		{
+			memmove(reader->bounce, reader->bounce + torn, (n - torn) * sizeof(*ring_data));
+			reader->lost += torn;
+		}
+		reader->tail += n;
+		n -= torn;
+	} while (!n && ring_avail(reader));
+	up_read(&ring_sem);
+	return n;
+}
+
+/** @function read_text
+ *  @brief Formats as many samples as fit in the buffer, one "<milli-degrees Celsius>\n"
+ *  line each. Called with reader->lock held.
+ *  @param reader The reader, its cursor is moved past the copied samples
+ *  @param buffer The user-space buffer
+ *  @param len The length of the buffer
+ *  @return the number of bytes copied, or a negative error code
+ */
+static ssize_t read_text(struct tmp36_reader *reader, char *buffer, size_t len)
+{
+	char text[TMP36_READ_CHUNK * TMP36_TEXT_MAX + 1];
+	unsigned int i, n;
+	size_t size;
+	ssize_t copied = 0;
 	int err = 0;
-	int tmpval, tmp;
-	get_random_bytes(&tmpval, sizeof(tmpval));
-	tmp = tmpval % 5 + 20;
-	sprintf(cmd_out, "%d", tmp);
-	printk(KERN_INFO "TMP36: received temperature read request. Returning random: [%s]\n", cmd_out);
-	size_out = strlen(cmd_out);
-	// copy_to_user has the format ( * to, *from, size) and returns 0 on success
-	err = copy_to_user(buffer, cmd_out, size_out);
 
-	if (err==0)
+	while (len - copied >= TMP36_TEXT_MAX)
 	{
-		printk(KERN_INFO "TMP36: Sent %d bytes to user-space\n", size_out);
-		return (size_out=0);
+		n = ring_copy(reader, min_t(size_t, TMP36_READ_CHUNK, (len - copied) / TMP36_TEXT_MAX));
+		if (!n)
+			break;
+		for (i = 0, size = 0; i < n; ++i)
+			size += sprintf(text + size, "%d\n", reader->bounce[i].millicelsius);
+		// copy_to_user has the format ( * to, *from, size) and returns 0 on success
+		if (copy_to_user(buffer + copied, text, size))
+		{
+			reader->lost += n; // Already past the cursor
+			err = -EFAULT;
+			break;
+		}
+		copied += size;
 	}
-	else
+	return copied ? copied : err;
+}
+
+/** @function read_binary
+ *  @brief Copies as many whole struct tmp36_sample records as fit in the buffer,
+ *  TMP36_READ_CHUNK at a time through the bounce buffer. Called with reader->lock held.
+ *  @param reader The reader, its cursor is moved past the copied samples
+ *  @param buffer The user-space buffer
+ *  @param len The length of the buffer
+ *  @return the number of bytes copied, or a negative error code
+ */
+static ssize_t read_binary(struct tmp36_reader *reader, char *buffer, size_t len)
+{
+	const size_t rec = sizeof(struct tmp36_sample);
+	ssize_t copied = 0;
+	int err = 0;
+	u32 n;
+
+	while (len - copied >= rec)
 	{
-		printk(KERN_INFO "TMP36: Failed to send %d bytes to user space\n", err);
-		return -EFAULT;
+		n = ring_copy(reader, min_t(size_t, TMP36_READ_CHUNK, (len - copied) / rec));
+		if (!n)
+			break;
+		if (copy_to_user(buffer + copied, reader->bounce, n * rec))
+		{
+			reader->lost += n; // Already past the cursor
+			err = -EFAULT;
+			break;
+		}
+		copied += n * rec;
+	}
+	return copied ? copied : err;
+}
+
+/** @function dev_ioctl
+ *  @brief Per file settings and the sampling settings shared by all files, see tmp36.h
+ *  @param filep A pointer to the file object
+ *  @param cmd TMP36_IOC_SET_FORMAT, TMP36_IOC_GET_LOST, TMP36_IOC_GET_CONFIG, TMP36_IOC_SET_CONFIG,
+ *  TMP36_IOC_SCAN or TMP36_IOC_SET_TAIL
+ *  @param arg Pointer to a __u32, a struct tmp36_config or a struct tmp36_scan in user space
+ *  holding the new value, or receiving the current one
+ *  @return 0 on success, -EFAULT, -EINVAL, -EBUSY, -EAGAIN, -ENOMEM or -ENOTTY otherwise
+ */
+static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+	struct tmp36_reader *reader = filep->private_data;
+	struct tmp36_config cfg;
+	struct tmp36_scan scan;
+	u32 val;
+	int ret;
+
+	switch (cmd)
+	{
+		case TMP36_IOC_SET_FORMAT:
+			if (get_user(val, (u32 __user *)arg))
+				return -EFAULT;
+			if (val != TMP36_FORMAT_TEXT && val != TMP36_FORMAT_BINARY)
+				return -EINVAL;
+			reader->format = val;
+			return 0;
+		case TMP36_IOC_GET_LOST:
+			mutex_lock(&reader->lock);
+			down_read(&ring_sem);
+			ring_avail(reader); // Account for what was overwritten up to now
+			val = reader->lost;
+			up_read(&ring_sem);
+			mutex_unlock(&reader->lock);
+			return put_user(val, (u32 __user *)arg);
+		case TMP36_IOC_SET_TAIL:
+			// The cursor of an mmap() consumer, so that poll() waits for what it has not seen
+			if (get_user(val, (u32 __user *)arg))
+				return -EFAULT;
+			mutex_lock(&reader->lock);
+			down_read(&ring_sem);
+			ret = (s32)(val - smp_load_acquire(&ring_head)) > 0 ? -EINVAL : 0;
+			if (!ret)
+				reader->tail = val;
+			up_read(&ring_sem);
+			mutex_unlock(&reader->lock);
+			return ret;
+		case TMP36_IOC_GET_CONFIG:
+			mutex_lock(&sampler_lock);
+			sampler_get_config(&cfg);
+			mutex_unlock(&sampler_lock);
+			return copy_to_user((void __user *)arg, &cfg, sizeof(cfg)) ? -EFAULT : 0;
+		case TMP36_IOC_SET_CONFIG:
+			if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+				return -EFAULT;
+			return sampler_configure(&cfg);
+		case TMP36_IOC_SCAN:
+			ret = sampler_scan(READ_ONCE(channels), &scan);
+			if (ret)
+				return ret;
+			return copy_to_user((void __user *)arg, &scan, sizeof(scan)) ? -EFAULT : 0;
+		default:
+			return -ENOTTY;
 	}
 }
 
@@ -157,10 +1116,86 @@ static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *of
 static ssize_t dev_write(struct file *filep, const char* buffer, size_t len, loff_t *offset)
 {
 	//Some data was written from user space
-	printk(KERN_INFO "Received buffer size: %d (Did you attempt to write to a sensor?)\n", len);
+	pr_debug("TMP36: Received buffer size: %zu (Did you attempt to write to a sensor?)\n", len);
 	return -EFAULT; //Always non-zero, should not write to this module!
 }
 
+/** @function ring_vma_open
+ *  @brief Counts a copy of a ring mapping, on fork() or when it is split
+ *  @param vma The new mapping
+ */
+static void ring_vma_open(struct vm_area_struct *vma)
+{
+	atomic_inc(&ring_maps);
+}
+
+/** @function ring_vma_close
+ *  @brief Drops an unmapped ring mapping
+ *  @param vma The mapping
+ */
+static void ring_vma_close(struct vm_area_struct *vma)
+{
+	atomic_dec(&ring_maps);
+}
+
+static const struct vm_operations_struct ring_vm_ops =
+{
+	.open = ring_vma_open,
+	.close = ring_vma_close,
+};
+
+/** @function dev_mmap
+ *  @brief Maps the sample ring (control page and records) read-only into user space.
+ *  The ring cannot be resized while it is mapped. mmap_sem is already held, so this
+ *  takes sampler_lock, which ring_resize() runs under, rather than ring_sem.
+ *  @param filep A pointer to the file object
+ *  @param vma The user mapping, must start at offset 0 and not exceed the ring
+ *  @return 0 on success, -EPERM for writable mappings, -ERESTARTSYS or -EINVAL otherwise
+ */
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+	int ret;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (mutex_lock_interruptible(&sampler_lock))
+		return -ERESTARTSYS;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_ALIGN(ring_bytes))
+	{
+		ret = -EINVAL;
+	}
+	else
+	{
+		vma->vm_flags &= ~VM_MAYWRITE;
+		ret = remap_vmalloc_range(vma, ring, 0);
+		if (!ret)
+		{
+			vma->vm_ops = &ring_vm_ops;
+			atomic_inc(&ring_maps);
+		}
+	}
+	mutex_unlock(&sampler_lock);
+	return ret;
+}
+
+/** @function dev_poll
+ *  @brief Reports the device as readable while there are samples after the file's
+ *  cursor, which read() or TMP36_IOC_SET_TAIL move. The sampling timer wakes up
+ *  tmp36_wq whenever it stores new samples.
+ *  @param filep A pointer to the file object
+ *  @param wait The poll table to register tmp36_wq with
+ *  @return POLLIN | POLLRDNORM if samples are available, 0 otherwise
+ */
+static unsigned int dev_poll(struct file *filep, poll_table *wait)
+{
+	struct tmp36_reader *reader = filep->private_data;
+
+	poll_wait(filep, &tmp36_wq, wait);
+	if (smp_load_acquire(&ring_head) != READ_ONCE(reader->tail))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
 /** @function dev_release
  *  @brief The device release function that is called whenever the device is closed/released by
  *  the userspace program
@@ -169,10 +1204,286 @@ static ssize_t dev_write(struct file *filep, const char* buffer, size_t len, lof
  */
 static int dev_release(struct inode *inodep, struct file *filep)
 {
-	printk(KERN_INFO "TMP36: Device successfully closed\n");
+	struct tmp36_reader *reader = filep->private_data;
+
+	mutex_lock(&sampler_lock);
+	openCnt--;
+	list_del(&reader->node);
+	sampler_put();
+	trace_tmp36_release(openCnt);
+	mutex_unlock(&sampler_lock);
+	kfree(reader);
 	return 0;
 }
 
+/** IIO channel for AINn, a 12-bit voltage in 16-bit storage scanned at index n */
+#define TMP36_IIO_CHANNEL(ain) \
+	{ \
+		.type = IIO_VOLTAGE, \
+		.indexed = 1, \
+		.channel = (ain), \
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE), \
+		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ) | \
+			BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO), \
+		.scan_index = (ain), \
+		.scan_type = { \
+			.sign = 'u', \
+			.realbits = 12, \
+			.storagebits = 16, \
+			.endianness = IIO_CPU, \
+		}, \
+	}
+
+/** IIO channels: AIN0 to AIN7, plus the timestamp */
+static const struct iio_chan_spec tmp36_iio_channels[] =
+{
+	TMP36_IIO_CHANNEL(0),
+	TMP36_IIO_CHANNEL(1),
+	TMP36_IIO_CHANNEL(2),
+	TMP36_IIO_CHANNEL(3),
+	TMP36_IIO_CHANNEL(4),
+	TMP36_IIO_CHANNEL(5),
+	TMP36_IIO_CHANNEL(6),
+	TMP36_IIO_CHANNEL(7),
+	IIO_CHAN_SOFT_TIMESTAMP(TMP36_NUM_AIN),
+};
+
+/** @function tmp36_read_raw
+ *  @brief Reads in_voltageN_raw, in_voltageN_scale (mV per code), sampling_frequency
+ *  and oversampling_ratio
+ *  @return IIO_VAL_* on success, a negative error code otherwise
+ */
+static int tmp36_read_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+		int *val, int *val2, long mask)
+{
+	u16 raw;
+	int ret;
+
+	switch (mask)
+	{
+		case IIO_CHAN_INFO_RAW:
+			ret = sampler_latest(chan->channel, &raw);
+			if (ret)
+				return ret;
+			*val = raw;
+			return IIO_VAL_INT;
+		case IIO_CHAN_INFO_SCALE:
+			// 1.8V reference over 12 bits
+			*val = 1800;
+			*val2 = 12;
+			return IIO_VAL_FRACTIONAL_LOG2;
+		case IIO_CHAN_INFO_SAMP_FREQ:
+			*val = USEC_PER_SEC;
+			*val2 = READ_ONCE(sample_period_us);
+			return IIO_VAL_FRACTIONAL;
+		case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+			*val = READ_ONCE(oversample);
+			return IIO_VAL_INT;
+		default:
+			return -EINVAL;
+	}
+}
+
+/** @function tmp36_write_raw
+ *  @brief Sets sampling_frequency, in Hz, or oversampling_ratio
+ *  @return 0 on success, -EINVAL otherwise
+ */
+static int tmp36_write_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+		int val, int val2, long mask)
+{
+	struct tmp36_config cfg;
+
+	if (val <= 0)
+		return -EINVAL;
+	sampler_get_config(&cfg);
+	switch (mask)
+	{
+		case IIO_CHAN_INFO_SAMP_FREQ:
+			cfg.sample_period_us = USEC_PER_SEC / val;
+			break;
+		case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+			cfg.oversample = val;
+			break;
+		default:
+			return -EINVAL;
+	}
+	return sampler_configure(&cfg);
+}
+
+/** @function tmp36_update_scan_mode
+ *  @brief Only lets a buffer scan channels the sampling timer samples, while it
+ *  runs. Other triggers convert the scan on demand and can use any channel.
+ *  @param indio_dev The IIO device
+ *  @param scan_mask The channels to scan, including the timestamp
+ *  @return 0 if the channels can be scanned, -EBUSY otherwise
+ */
+static int tmp36_update_scan_mode(struct iio_dev *indio_dev, const unsigned long *scan_mask)
+{
+	u32 mask = *scan_mask & (BIT(TMP36_NUM_AIN) - 1);
+
+	if (indio_dev->trig == tmp36_trig && (mask & ~READ_ONCE(channels)))
+		return -EBUSY;
+	return 0;
+}
+
+static const struct iio_info tmp36_iio_info =
+{
+	.read_raw = tmp36_read_raw,
+	.write_raw = tmp36_write_raw,
+	.update_scan_mode = tmp36_update_scan_mode,
+};
+
+/** @function tmp36_push_scan
+ *  @brief Pushes the samples of the scanned channels, packed in channel order and
+ *  timestamped with the pass they were taken in, to the IIO buffers
+ *  @param indio_dev The IIO device
+ *  @param mask The scanned channels
+ *  @param pass The samples, only pushed if it has all of the scanned channels
+ */
+static void tmp36_push_scan(struct iio_dev *indio_dev, u32 mask, const struct tmp36_scan *pass)
+{
+	struct {
+		u16 raw[TMP36_NUM_AIN];
+		s64 timestamp __aligned(8);
+	} scan;
+	unsigned int ain, n = 0;
+
+	if ((pass->channels & mask) != mask)
+		return;
+	memset(&scan, 0, sizeof(scan));
+	for (ain = 0; ain < TMP36_NUM_AIN; ++ain)
+	{
+		if (mask & BIT(ain))
+			scan.raw[n++] = pass->raw[ain];
+	}
+	iio_push_to_buffers_with_timestamp(indio_dev, &scan, pass->timestamp);
+}
+
+/** @function tmp36_trigger_handler
+ *  @brief Bottom half of the triggered buffer. With the tmp36 trigger, pushes every
+ *  pass the sampling timer queued since the last run, each once. With any other
+ *  trigger, pushes the latest samples, see sampler_scan.
+ *  @param irq The IRQ of the trigger
+ *  @param p The struct iio_poll_func
+ *  @return IRQ_HANDLED
+ */
+static irqreturn_t tmp36_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct tmp36_scan pass;
+	u32 mask = *indio_dev->active_scan_mask & (BIT(TMP36_NUM_AIN) - 1);
+
+	if (indio_dev->trig == tmp36_trig)
+	{
+		while (kfifo_get(&trig_fifo, &pass))
+			tmp36_push_scan(indio_dev, mask, &pass);
+	}
+	else if (!sampler_scan(mask, &pass))
+	{
+		tmp36_push_scan(indio_dev, mask, &pass);
+	}
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+/** @function tmp36_trigger_set_state
+ *  @brief While a buffer is attached to the tmp36 trigger, it is a user of the
+ *  sampling timer, which fires the trigger on every new sample
+ *  @param trig The tmp36 trigger
+ *  @param state Whether the trigger is being enabled
+ *  @return 0
+ */
+static int tmp36_trigger_set_state(struct iio_trigger *trig, bool state)
+{
+	mutex_lock(&sampler_lock);
+	if (state)
+	{
+		sampler_get();
+		kfifo_reset(&trig_fifo); // Nothing queues or dequeues while trig_enabled is false
+		trig_enabled = true;
+	}
+	else
+	{
+		trig_enabled = false;
+		sampler_put();
+	}
+	mutex_unlock(&sampler_lock);
+	return 0;
+}
+
+static const struct iio_trigger_ops tmp36_trigger_ops =
+{
+	.set_trigger_state = tmp36_trigger_set_state,
+};
+
+/** @function tmp36_iio_setup
+ *  @brief Registers the IIO device, its triggered buffer and the tmp36 trigger,
+ *  which is also made the default trigger of the device
+ *  @return 0 on success, a negative error code otherwise
+ */
+static int tmp36_iio_setup(void)
+{
+	int result;
+
+	tmp36_iio = iio_device_alloc(0);
+	if (!tmp36_iio)
+		return -ENOMEM;
+	tmp36_iio->dev.parent = tmp36Device;
+	tmp36_iio->name = DEVICE_NAME;
+	tmp36_iio->info = &tmp36_iio_info;
+	tmp36_iio->modes = INDIO_DIRECT_MODE;
+	tmp36_iio->channels = tmp36_iio_channels;
+	tmp36_iio->num_channels = ARRAY_SIZE(tmp36_iio_channels);
+
+	tmp36_trig = iio_trigger_alloc("%s-dev%d", tmp36_iio->name, tmp36_iio->id);
+	if (!tmp36_trig)
+	{
+		result = -ENOMEM;
+		goto err_free_dev;
+	}
+	tmp36_trig->dev.parent = tmp36Device;
+	tmp36_trig->ops = &tmp36_trigger_ops;
+	result = iio_trigger_register(tmp36_trig);
+	if (result)
+		goto err_free_trig;
+	tmp36_iio->trig = iio_trigger_get(tmp36_trig);
+
+	// Scans carry the time of their pass, no timestamp is needed from the top half
+	result = iio_triggered_buffer_setup(tmp36_iio, NULL, tmp36_trigger_handler, NULL);
+	if (result)
+		goto err_unregister_trig;
+
+	result = iio_device_register(tmp36_iio);
+	if (result)
+		goto err_cleanup_buffer;
+	return 0;
+
+err_cleanup_buffer:
+	iio_triggered_buffer_cleanup(tmp36_iio);
+err_unregister_trig:
+	iio_trigger_put(tmp36_iio->trig);
+	tmp36_iio->trig = NULL;
+	iio_trigger_unregister(tmp36_trig);
+err_free_trig:
+	iio_trigger_free(tmp36_trig);
+err_free_dev:
+	iio_device_free(tmp36_iio);
+	return result;
+}
+
+/** @function tmp36_iio_release
+ *  @brief Unregisters everything tmp36_iio_setup registered, in reverse order
+ */
+static void tmp36_iio_release(void)
+{
+	iio_device_unregister(tmp36_iio);
+	iio_triggered_buffer_cleanup(tmp36_iio);
+	iio_trigger_unregister(tmp36_trig);
+	iio_trigger_free(tmp36_trig);
+	iio_device_free(tmp36_iio); // Also drops the reference in tmp36_iio->trig
+}
+
 /** @brief Mandatory function calls 
 */
 module_init(tmp36_init);
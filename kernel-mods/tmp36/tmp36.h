@@ -0,0 +1,93 @@
+/**
+ * @file   tmp36.h
+ * @author Santiago Pagola
+ * @license GPL
+ * @brief  Definitions shared between the tmp36 driver and user space.
+ *
+ * /dev/tmp36 can be mmap()ed to consume samples without a syscall per batch.
+ * The mapping starts with a struct tmp36_ring control page, followed by
+ * tmp36_ring.size records of struct tmp36_sample at tmp36_ring.data_offset.
+ * head is a free-running count of the samples written so far, the record for
+ * count n lives at n % size. The driver never waits for consumers and always
+ * overwrites the oldest record, so every consumer keeps its own cursor: records
+ * from head - size to head are valid, and a record copied out is only known to
+ * be intact if head is still less than size past it once the copy is done. The
+ * copy has to be ordered before that second load of head, e.g. with
+ * __atomic_thread_fence(__ATOMIC_ACQUIRE): an acquire load of head on its own
+ * only orders the accesses after it. A consumer that sleeps in poll() publishes
+ * its cursor first with TMP36_IOC_SET_TAIL, poll() compares head against it.
+ *
+ * read() returns text by default. TMP36_IOC_SET_FORMAT with TMP36_FORMAT_BINARY
+ * switches the file to whole struct tmp36_sample records instead. Every open
+ * file has its own cursor, TMP36_IOC_GET_LOST reports how many samples it lost
+ * by falling a whole ring behind or having them overwritten while read() copied
+ * them. read() applies the same check as above and never returns such samples.
+ *
+ * The sampling settings are shared by all files and can be changed at any time
+ * with TMP36_IOC_SET_CONFIG, usually after reading the current ones with
+ * TMP36_IOC_GET_CONFIG. Changing fifo_depth empties the ring and fails with
+ * EBUSY while the ring is mapped.
+ *
+ * TMP36_IOC_SCAN returns the last sample of every enabled channel at once. All
+ * of them are converted in a single pass of the ADC step sequencer per period.
+ */
+
+#ifndef _TMP36_H_
+#define _TMP36_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define TMP36_RING_VERSION (2)
+
+/* read() formats */
+#define TMP36_FORMAT_TEXT   (0) /*!< "<milli-degrees Celsius>\n" per sample */
+#define TMP36_FORMAT_BINARY (1) /*!< struct tmp36_sample per sample */
+
+#define TMP36_NUM_AIN      (8) /*!< AIN0 to AIN7 */
+
+/* ioctl commands */
+#define TMP36_IOC_MAGIC      't'
+#define TMP36_IOC_SET_FORMAT _IOW(TMP36_IOC_MAGIC, 1, __u32)
+#define TMP36_IOC_GET_LOST   _IOR(TMP36_IOC_MAGIC, 2, __u32)
+#define TMP36_IOC_GET_CONFIG _IOR(TMP36_IOC_MAGIC, 3, struct tmp36_config)
+#define TMP36_IOC_SET_CONFIG _IOW(TMP36_IOC_MAGIC, 4, struct tmp36_config)
+#define TMP36_IOC_SCAN       _IOR(TMP36_IOC_MAGIC, 5, struct tmp36_scan)
+#define TMP36_IOC_SET_TAIL   _IOW(TMP36_IOC_MAGIC, 6, __u32)
+
+/** Sampling settings, the module parameters of the same name are the defaults */
+struct tmp36_config {
+	__u32 sample_period_us; /*!< time between two samples of a channel */
+	__u32 hw_avg;           /*!< hardware averaging of 2^hw_avg conversions, 0 (ADC_AVG0) to 4 (ADC_AVG16) */
+	__u32 fifo_depth;       /*!< records in the ring, rounded up to a power of 2 */
+	__u32 channels;         /*!< mask of the enabled analog inputs, bit n for AINn */
+	__u32 oversample;       /*!< conversions averaged into each sample, a power of 2 */
+	__u32 ema_shift;        /*!< moving average weight of 1/2^ema_shift, 0 disables it */
+};
+
+/** One timestamped sample */
+struct tmp36_sample {
+	__s64 timestamp;    /*!< CLOCK_MONOTONIC time the conversion was started, in ns */
+	__s32 millicelsius; /*!< temperature in milli-degrees Celsius */
+	__u16 raw;          /*!< 12-bit ADC code */
+	__u16 channel;      /*!< analog input the sample was taken from, n for AINn */
+};
+
+/** The last sample of every channel, indexed by AIN */
+struct tmp36_scan {
+	__s64 timestamp;                   /*!< CLOCK_MONOTONIC time of the last pass over the channels, in ns */
+	__u32 channels;                    /*!< mask of the valid entries, bit n for AINn */
+	__s32 millicelsius[TMP36_NUM_AIN]; /*!< temperature in milli-degrees Celsius */
+	__u16 raw[TMP36_NUM_AIN];          /*!< 12-bit ADC code */
+	__u32 reserved;                    /*!< always 0 */
+};
+
+/** Control page, at offset 0 of the mapping */
+struct tmp36_ring {
+	__u32 version;     /*!< TMP36_RING_VERSION */
+	__u32 size;        /*!< number of records in the ring, a power of 2 */
+	__u32 data_offset; /*!< offset of the first record from the start of the mapping */
+	__u32 head;        /*!< samples produced so far */
+};
+
+#endif /* _TMP36_H_ */
@@ -0,0 +1,123 @@
+/**
+ * @file   tmp36_trace.h
+ * @author Santiago Pagola
+ * @license GPL
+ * @brief  Tracepoints of the tmp36 driver, in the tmp36 trace system.
+ *
+ * Enable them with e.g.
+ *   echo 1 > /sys/kernel/debug/tracing/events/tmp36/enable
+ * or record them with perf record -e 'tmp36:*'. They cost a patched-out
+ * branch while disabled. tmp36_sample fires for every sample, so enable it
+ * on its own only when needed.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tmp36
+
+#if !defined(_TMP36_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _TMP36_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+#include "tmp36.h"
+
+DECLARE_EVENT_CLASS(tmp36_file,
+	TP_PROTO(int open_cnt),
+	TP_ARGS(open_cnt),
+	TP_STRUCT__entry(
+		__field(int, open_cnt)
+	),
+	TP_fast_assign(
+		__entry->open_cnt = open_cnt;
+	),
+	TP_printk("open_cnt=%d", __entry->open_cnt)
+);
+
+/** /dev/tmp36 opened, with the resulting open count */
+DEFINE_EVENT(tmp36_file, tmp36_open,
+	TP_PROTO(int open_cnt),
+	TP_ARGS(open_cnt)
+);
+
+/** /dev/tmp36 closed, with the resulting open count */
+DEFINE_EVENT(tmp36_file, tmp36_release,
+	TP_PROTO(int open_cnt),
+	TP_ARGS(open_cnt)
+);
+
+/** The sampling timer stored a sample in the ring */
+TRACE_EVENT(tmp36_sample,
+	TP_PROTO(unsigned int channel, u16 raw, s32 millicelsius, s64 timestamp),
+	TP_ARGS(channel, raw, millicelsius, timestamp),
+	TP_STRUCT__entry(
+		__field(unsigned int, channel)
+		__field(u16, raw)
+		__field(s32, millicelsius)
+		__field(s64, timestamp)
+	),
+	TP_fast_assign(
+		__entry->channel = channel;
+		__entry->raw = raw;
+		__entry->millicelsius = millicelsius;
+		__entry->timestamp = timestamp;
+	),
+	TP_printk("ain=%u raw=%u millicelsius=%d timestamp=%lld",
+		__entry->channel, __entry->raw, __entry->millicelsius, __entry->timestamp)
+);
+
+/** A read returned, including the time it spent waiting for samples */
+TRACE_EVENT(tmp36_read,
+	TP_PROTO(u32 format, ssize_t ret, u32 lost, ktime_t start),
+	TP_ARGS(format, ret, lost, start),
+	TP_STRUCT__entry(
+		__field(u32, format)
+		__field(ssize_t, ret)
+		__field(u32, lost)
+		__field(s64, latency_ns)
+	),
+	TP_fast_assign(
+		__entry->format = format;
+		__entry->ret = ret;
+		__entry->lost = lost;
+		__entry->latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	),
+	TP_printk("format=%s ret=%zd lost=%u latency_ns=%lld",
+		__entry->format ? "binary" : "text", __entry->ret, __entry->lost,
+		__entry->latency_ns)
+);
+
+/** The sampling settings were changed */
+TRACE_EVENT(tmp36_configure,
+	TP_PROTO(const struct tmp36_config *cfg, int ret),
+	TP_ARGS(cfg, ret),
+	TP_STRUCT__entry(
+		__field(u32, sample_period_us)
+		__field(u32, hw_avg)
+		__field(u32, fifo_depth)
+		__field(u32, channels)
+		__field(u32, oversample)
+		__field(u32, ema_shift)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->sample_period_us = cfg->sample_period_us;
+		__entry->hw_avg = cfg->hw_avg;
+		__entry->fifo_depth = cfg->fifo_depth;
+		__entry->channels = cfg->channels;
+		__entry->oversample = cfg->oversample;
+		__entry->ema_shift = cfg->ema_shift;
+		__entry->ret = ret;
+	),
+	TP_printk("period_us=%u hw_avg=%u fifo_depth=%u channels=0x%02x oversample=%u ema_shift=%u ret=%d",
+		__entry->sample_period_us, __entry->hw_avg, __entry->fifo_depth,
+		__entry->channels, __entry->oversample, __entry->ema_shift, __entry->ret)
+);
+
+#endif /* _TMP36_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tmp36_trace
+#include <trace/define_trace.h>
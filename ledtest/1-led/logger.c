@@ -22,6 +22,33 @@ int write_2_led(const char* value)
 	return 0;
 }
 
+/* Write a value to an attribute of the LED class device */
+static int write_led_attr(const char* attr, const char* value)
+{
+	char path[100];
+	FILE *fa;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", GLED01_LED, attr);
+	fa = fopen(path, "w");
+	if (fa == NULL) return -1;
+	ret = fputs(value, fa);
+	if (fclose(fa) != 0 || ret < 0) return -1;
+	return 0;
+}
+
+/* Have the kernel's timer trigger blink the led, toggling every ms milliseconds */
+int blink_led(int ms)
+{
+	char delay[16];
+
+	snprintf(delay, sizeof(delay), "%d", ms);
+	if (write_led_attr("trigger", "timer")) return -1;
+	if (write_led_attr("delay_on", delay)) return -1;
+	if (write_led_attr("delay_off", delay)) return -1;
+	return 0;
+}
+
 void remove_log_file()
 {
 	if (!unlink(LOG_PATH)) logger ("Success!");
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 
 #define GLED01_DEV "/dev/gled01"
+#define GLED01_LED "/sys/class/leds/gled01::user" // The same LED in the LED class
 #define LOG_PATH  "/var/log/ledaemon.log"
 
 FILE *ft; // File descriptor used for reading from P9_40
@@ -12,6 +13,7 @@ FILE *fl; // File descriptor used for the log file
 int fled; // File descriptor used for interacting with the led
 
 int write_2_led(const char* value);
+int blink_led(int ms);
 void remove_log_file();
 void set_silent(bool s);
 void logger(const char* msg);
@@ -46,7 +46,7 @@ void help()
 	printf("-h\tShow this help and exit\n");
 	printf("-l\t\"Listen\" mode, non-interactive\n");
 	printf("-r\tRemove log file and exit\n");
-	printf("-t <m>\tToggle led state every m milliseconds\n");
+	printf("-t <m>\tToggle led state every m milliseconds, with the kernel's timer trigger if available\n");
 	printf("-s\tSilent mode (e.g. if running as daemon, logging to file)\n");
 }
 
@@ -128,6 +128,12 @@ int main (int argc, char *argv[])
 	{
 		if (toggle)
 		{
+			//Let the kernel blink the led if it can, this program is not needed for that
+			if (!blink_led(time))
+			{
+				logger ( msg_app_int ("Led blinking in the kernel every %d ms", time));
+				return 0;
+			}
 			while(1)
 			{
 				if (!strcmp(c,"1")) memset(c,'0',1);
@@ -18,6 +18,7 @@ const char* log_path = "/var/log/ledaemon.log";
 bool silent = false;
 
 int write_2_led(char lednr, char value);
+int write_batch_2_led(const char* batch);
 void remove_log_file();
 void set_silent(bool s);
 void logger(const char* msg);
@@ -39,6 +40,18 @@ int write_2_led(char lednr, char value)
 	return 0;
 }
 
+/* Several <led><state> pairs, applied by a single write */
+int write_batch_2_led(const char* batch)
+{
+	int ret;
+	fled = open(TLLED_DEV, O_RDWR);
+	if (fled < 0) return -1;
+	ret = write(fled, batch, strlen(batch));
+	close(fled);
+	if (ret < 0) return errno;
+	return 0;
+}
+
 void remove_log_file()
 {
 	if (!unlink(log_path)) logger ("Success!");
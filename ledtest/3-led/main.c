@@ -45,30 +45,19 @@ void help()
 void set_state(unsigned s)
 {
 	int ret;
+	// Only LED s is on, all three are set with a single write
 	switch(s)
 	{
 		case 0:
-			ret = write_2_led('0','1');
-			if (ret == -1) logger (msg_err ("Error", errno));
-			ret = write_2_led('1','0');
-			if (ret == -1) logger (msg_err ("Error", errno));
-			ret = write_2_led('2','0');
+			ret = write_batch_2_led("01 10 20");
 			if (ret == -1) logger (msg_err ("Error", errno));
 			break;
 		case 1:
-			ret = write_2_led('0','0');
-			if (ret == -1) logger (msg_err ("Error", errno));
-			ret = write_2_led('1','1');
-			if (ret == -1) logger (msg_err ("Error", errno));
-			ret = write_2_led('2','0');
+			ret = write_batch_2_led("00 11 20");
 			if (ret == -1) logger (msg_err ("Error", errno));
 			break;
 		case 2:
-			ret = write_2_led('0','0');
-			if (ret == -1) logger (msg_err ("Error", errno));
-			ret = write_2_led('1','0');
-			if (ret == -1) logger (msg_err ("Error", errno));
-			ret = write_2_led('2','1');
+			ret = write_batch_2_led("00 10 21");
 			if (ret == -1) logger (msg_err ("Error", errno));
 			break;
 		default:
@@ -6,21 +6,28 @@ then
 	exit 1
 fi
 
-dmesg | grep -q BB-ADC
+# The tmp36 driver owns the ADC and provides the IIO device read from
+# /sys/bus/iio/devices/iio:device0/in_voltage1_raw, so it replaces the
+# BB-ADC cape and ti_am335x_adc
+lsmod | grep -q "ti_am335x_adc"
 if [ $? -eq 0 ]
 then
-	echo "IIO cape enabled"
-else
-	echo "Enabling IIO cape"
-	sh -c "echo 'BB-ADC' > /sys/devices/platform/bone_capemgr/slots"
+	echo "Removing ti_am335x_adc"
+	modprobe -r ti_am335x_adc
 fi
 
-# Just make sure that module is loaded
-lsmod | grep -q "ti_am335x_adc"
-if [ $? -ne 0 ]
+if [[ -f /home/debian/bbbw-utils/kernel-mods/tmp36/tmp36.ko ]]
 then
-	echo "Modprobing ti_am335x_adc"
-	modprobe ti_am335x_adc
+	lsmod | grep -q "tmp36"
+	if [ $? -ne 0 ]
+	then
+		echo "Insmoding tmp36.ko"
+		insmod /home/debian/bbbw-utils/kernel-mods/tmp36/tmp36.ko
+	else
+		echo "tmp36 already insmoded"
+	fi
+else
+	echo "Compile tmp36 module and run this script again"
 fi
 
 # Insmod the ledtoggle driver
@@ -5,17 +5,20 @@ then
 	exit 1
 fi
 
-dmesg | grep -q BB-ADC
-if [ $? -ne 0 ]
+# The tmp36 driver owns the ADC and provides iio:device0 in place of ti_am335x_adc
+lsmod | grep -q "ti_am335x_adc"
+if [ $? -eq 0 ]
 then
-	sh -c "echo 'BB-ADC' > /sys/devices/platform/bone_capemgr/slots"
+	modprobe -r ti_am335x_adc
 fi
 
-# Just make sure that module is loaded
-lsmod | grep -q "ti_am335x_adc"
-if [ $? -ne 0 ]
+if [[ -f /home/debian/bbbw-utils/kernel-mods/tmp36/tmp36.ko ]]
 then
-	modprobe ti_am335x_adc
+	lsmod | grep -q "tmp36"
+	if [ $? -ne 0 ]
+	then
+		insmod /home/debian/bbbw-utils/kernel-mods/tmp36/tmp36.ko
+	fi
 fi
 
 # Insmod the ledtoggle driver